@@ -0,0 +1,62 @@
+# FluCoMa and the libraries it needs, shared by the app and the benchmarks
+
+include(FetchContent)
+
+set(FLUID_BRANCH "origin/main" CACHE STRING "Branch to pull flucoma dependencies from")
+set(FLUID_PATH "" CACHE PATH "Optional path to the Fluid Decomposition repo")
+
+FetchContent_Declare(
+  HISSTools
+  GIT_REPOSITORY https://github.com/AlexHarker/HISSTools_Library
+  GIT_PROGRESS TRUE
+  GIT_TAG f3292ad 
+)
+
+
+FetchContent_Declare(
+  Eigen
+  GIT_SHALLOW TRUE
+  GIT_REPOSITORY https://gitlab.com/libeigen/eigen.git
+  GIT_PROGRESS TRUE
+  GIT_BRANCH "3.4"
+  GIT_TAG "3.4.0"
+  #https://stackoverflow.com/questions/77210209/how-to-prevent-eigen-targets-to-show-up-in-the-main-app-in-a-cmake-project
+  SOURCE_SUBDIR cmake 
+
+)
+
+FetchContent_Declare(
+  Spectra
+  GIT_SHALLOW TRUE
+  GIT_REPOSITORY https://github.com/yixuan/spectra
+  GIT_PROGRESS TRUE
+  GIT_BRANCH "master"
+  GIT_TAG "v1.0.1"
+)
+
+FetchContent_Declare(
+  Memory
+  GIT_SHALLOW TRUE  
+  GIT_REPOSITORY https://github.com/foonathan/memory.git
+  GIT_PROGRESS TRUE
+  GIT_TAG main
+)
+
+
+FetchContent_Declare(
+   flucoma-core
+   GIT_REPOSITORY https://github.com/flucoma/flucoma-core.git
+   GIT_PROGRESS TRUE
+   GIT_TAG ${FLUID_BRANCH}
+)
+
+
+FetchContent_MakeAvailable(HISSTools)
+FetchContent_MakeAvailable(Eigen)
+FetchContent_MakeAvailable(Memory)
+FetchContent_MakeAvailable(Spectra)
+FetchContent_MakeAvailable(flucoma-core)
+
+include(flucoma_version)
+include(flucoma-buildtools)
+include(flucoma-buildtype)
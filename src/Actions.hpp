@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 using std::string;
@@ -8,8 +9,8 @@ namespace actions{
 
 enum class ActionType{
     go, up, down, left, right, turn, stop,
-    die, volume, seek, wander, avoid, join,
-    align, make, map, background};
+    die, volume, seek, timbre, wander, avoid, join,
+    align, make, map, add, background, grains};
 
 struct Action{
     ActionType type;
@@ -64,6 +65,13 @@ struct seek: public Action{
     seek():Action::Action(ActionType::seek){freq = 3;}
 };
 
+// toward the cells that sound like a segment or a cluster of the terrain
+struct timbre: public Action{
+    bool cluster{false};
+    int target{0};
+    timbre():Action::Action(ActionType::timbre){freq = 3;}
+};
+
 struct wander: public Action{
     float prob;
     wander():Action::Action(ActionType::wander){freq = 2;}
@@ -101,6 +109,13 @@ struct make: public Action{
 struct map: public Action{
     map():Action::Action(ActionType::map){}
     string file;
+    uint32_t descriptors = 0;// mask of Descriptors named after the file, 0 for mfcc
+    bool mapped{false};// keep decoded sources in mapped cache files
+};
+
+struct add: public Action{
+    add():Action::Action(ActionType::add){}
+    string file;
 };
 
 struct background: public Action{
@@ -108,5 +123,10 @@ struct background: public Action{
     background():Action::Action(ActionType::background){}
 };
 
+struct grains: public Action{
+    int max = 1024;
+    grains():Action::Action(ActionType::grains){}
+};
+
 
 }
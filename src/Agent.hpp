@@ -4,14 +4,38 @@
 #include "cinder/Rand.h"
 #include "Corpus.hpp"
 #include "Synth.hpp"
+#include "Random.hpp"
 
 using namespace cinder;
 using SynthRef = shared_ptr<Synth>;
 
+// Structure-of-arrays storage for the agents of one flock.
+// Hot kinematic state is kept in contiguous arrays so flock rules can
+// sweep it without chasing pointers; icon and color are shared per flock.
+struct AgentStore{
+    std::vector<vec2> positions;
+    std::vector<vec2> velocities;
+    std::vector<vec2> accelerations;
+    std::vector<vec2> directions;
+    std::vector<float> headings;
+    std::vector<uint8_t> alive;
+    std::vector<SynthRef> synths;
+    string icon{"▶"};
+    Color color{1, 1, 1};
+    vec2 bounds{1, 1};
+    float maxSpeed{4};
+    float timeScale{1};// motion per tick relative to a 30 fps frame
+
+    size_t size() const {return positions.size();}
+    size_t add(vec2 pos, vec2 vel, SynthRef synth);
+    template<typename F> size_t compact(F&& release);
+    void reserve(size_t n);
+};
+
+// Lightweight handle to one slot of an AgentStore.
 class Agent {
     public:
-        Agent(vec2 pos, vec2 vel = {0,0}, string icon="▶",
-              string color = "white", Corpus* c = nullptr);
+        Agent(AgentStore* store, size_t index);
         void update();
         void draw();
         void wrap();
@@ -21,9 +45,10 @@ class Agent {
         vec2 getPosition();
         vec2 getVelocity();
         vec2 getDirection();
+        bool isAlive();
     
         void go(float mult);
-        void wander(float prob);
+        void wander(float prob, Rng& rng);
         void turn(float deg);
         void seek(float x, float y);
         void up();
@@ -34,129 +59,171 @@ class Agent {
         void die();
         
     private:
+        friend struct AgentStore;
         void computeHeading();
-        vec2 mPosition, mVelocity, mAcceleration;
-        vec2 mNormVelocity;
-        float mRadius, mDecay, mMaxSpeed, mHeading;
-        string mIcon;
-        Color mColor;
-        SynthRef mSynth;
-        bool mDead{false};
+        AgentStore* mStore;
+        size_t mIndex;
 };
 
-Agent::Agent(vec2 position, vec2 velocity,
-             string icon, string color,
-             Corpus* c) {
-    mPosition = position;
-    mVelocity = velocity;
-    mIcon = icon;
-    color[0] = toupper(color[0]);
-    mColor = svgNameToRgb(color.c_str());
-    mAcceleration = vec2(0.0f);
-    computeHeading();
-    mMaxSpeed = 4.;
-    mDecay = 0.99f;
-    if(c->mEngine == 0)
-        mSynth = SynthRef(new AdditiveSynth(c));
-    else
-        mSynth = SynthRef(new GranularSynth(c));
-    if(mSynth) mSynth->update(mPosition);
+void AgentStore::reserve(size_t n){
+    positions.reserve(n);
+    velocities.reserve(n);
+    accelerations.reserve(n);
+    directions.reserve(n);
+    headings.reserve(n);
+    alive.reserve(n);
+    synths.reserve(n);
+}
+
+size_t AgentStore::add(vec2 pos, vec2 vel, SynthRef synth){
+    size_t index = size();
+    positions.push_back(pos);
+    velocities.push_back(vel);
+    accelerations.push_back(vec2(0.0f));
+    directions.push_back(vec2(0.0f));
+    headings.push_back(0);
+    alive.push_back(1);
+    synths.push_back(synth);
+    Agent agent(this, index);
+    agent.computeHeading();
+    if (synth) synth->update(pos, bounds, length(vel) * timeScale);
+    return index;
 }
 
+// Removes dead agents keeping the order of the living ones, their synths
+// are passed to release. Returns the number of agents removed.
+template<typename F>
+size_t AgentStore::compact(F&& release){
+    size_t n = 0;
+    for (size_t i = 0; i < size(); i++){
+        if (!alive[i]){
+            release(std::move(synths[i]));
+            continue;
+        }
+        if (n != i){
+            positions[n] = positions[i];
+            velocities[n] = velocities[i];
+            accelerations[n] = accelerations[i];
+            directions[n] = directions[i];
+            headings[n] = headings[i];
+            alive[n] = 1;
+            synths[n] = std::move(synths[i]);
+        }
+        n++;
+    }
+    size_t removed = size() - n;
+    positions.resize(n);
+    velocities.resize(n);
+    accelerations.resize(n);
+    directions.resize(n);
+    headings.resize(n);
+    alive.resize(n);
+    synths.resize(n);
+    return removed;
+}
+
+Agent::Agent(AgentStore* store, size_t index):
+    mStore(store), mIndex(index){}
+
 void Agent::computeHeading(){
-    if (mVelocity[0] == 0 && mVelocity[1] == 0){
-        mNormVelocity = mVelocity;
-        mHeading = 0;
+    vec2 vel = mStore->velocities[mIndex];
+    if (vel[0] == 0 && vel[1] == 0){
+        mStore->directions[mIndex] = vel;
+        mStore->headings[mIndex] = 0;
     }
     else {
-        mNormVelocity = glm::normalize(mVelocity);
-        mHeading = atan2(mVelocity[1], mVelocity[0]);
+        mStore->directions[mIndex] = glm::normalize(vel);
+        mStore->headings[mIndex] = atan2(vel[1], vel[0]);
     }
 }
 
 void Agent::wrap(){
-    int width = app::getWindowWidth();
-    int height = app::getWindowHeight();
-    if (mPosition.x > width) mPosition.x -= width;
-    else if (mPosition.x < 0) mPosition.x += width;
-    if (mPosition.y > height) mPosition.y -=  height;
-    else if (mPosition.y < 0) mPosition.y += height;
+    float width = mStore->bounds.x;
+    float height = mStore->bounds.y;
+    vec2& pos = mStore->positions[mIndex];
+    if (pos.x > width) pos.x -= width;
+    else if (pos.x < 0) pos.x += width;
+    if (pos.y > height) pos.y -=  height;
+    else if (pos.y < 0) pos.y += height;
 }
 
 void Agent::update() {
-    mVelocity += mAcceleration;
-    float v = glm::length2(mVelocity);
-    float mag = length(mVelocity);
-    if (mag > mMaxSpeed) mVelocity *= (mMaxSpeed / mag);
-    mPosition +=mVelocity;
-    mAcceleration *= 0;
+    vec2& vel = mStore->velocities[mIndex];
+    vec2& acc = mStore->accelerations[mIndex];
+    vel += acc * mStore->timeScale;
+    float mag = length(vel);
+    if (mag > mStore->maxSpeed) vel *= (mStore->maxSpeed / mag);
+    mStore->positions[mIndex] += vel * mStore->timeScale;
+    acc *= 0;
     computeHeading();
-    if(mSynth) mSynth->update(mPosition);
+    if(mStore->synths[mIndex])
+        mStore->synths[mIndex]->update(mStore->positions[mIndex], mStore->bounds, length(vel) * mStore->timeScale);
 }
 
 void Agent::draw() {
-    if(mDead) return;
+    if(!mStore->alive[mIndex]) return;
     gl::pushModelMatrix();
-    gl::translate(mPosition);
-    gl::rotate(mHeading);
-    gl::drawString(mIcon, {0,0}, mColor);
+    gl::translate(mStore->positions[mIndex]);
+    gl::rotate(mStore->headings[mIndex]);
+    gl::drawString(mStore->icon, {0,0}, mStore->color);
     gl::popModelMatrix();
 }
 
 void Agent::applyForce(const vec2 &force) {
-    mAcceleration += force;
+    mStore->accelerations[mIndex] += force;
 }
 
 vec2 Agent::getPosition() {
-    return mPosition;
+    return mStore->positions[mIndex];
 }
 
 vec2 Agent::getVelocity() {
-    return mVelocity;
+    return mStore->velocities[mIndex];
 }
 
 vec2 Agent::getDirection() {
-    return mNormVelocity;
+    return mStore->directions[mIndex];
+}
+
+bool Agent::isAlive() {
+    return mStore->alive[mIndex];
 }
 
 void Agent::go(float mul){
     update();
-    mPosition += (mVelocity * mul);
+    mStore->positions[mIndex] += (mStore->velocities[mIndex] * mul * mStore->timeScale);
     wrap();
 }
 
 void Agent::turn(float angle){
     float rad = 2 * M_PI * angle / 360.0;
-    float x = mVelocity[0];
-    float y = mVelocity[1];
+    vec2& vel = mStore->velocities[mIndex];
+    float x = vel[0];
+    float y = vel[1];
     float c = std::cos(rad);
     float s = std::sin(rad);
-    mVelocity[0] = x * c - y * s;
-    mVelocity[1] = x * s + y * c;
+    vel[0] = x * c - y * s;
+    vel[1] = x * s + y * c;
     computeHeading();
 }
 
 void Agent::up(){
-    mVelocity[0] = 0;
-    mVelocity[1] = -1;
+    mStore->velocities[mIndex] = vec2(0, -1);
     computeHeading();
 }
 
 void Agent::down(){
-    mVelocity[0] = 0;
-    mVelocity[1] = 1;
+    mStore->velocities[mIndex] = vec2(0, 1);
     computeHeading();
 }
 
 void Agent::left(){
-    mVelocity[0] = -1;
-    mVelocity[1] = 0;
+    mStore->velocities[mIndex] = vec2(-1, 0);
     computeHeading();
 }
 
 void Agent::right(){
-    mVelocity[0] = 1;
-    mVelocity[1] = 0;
+    mStore->velocities[mIndex] = vec2(1, 0);
     computeHeading();
 }
 
@@ -164,10 +231,10 @@ void Agent::stop(){
     go(0);
 }
 
-void Agent::wander(float prob){
-    float r = (float) rand() / (RAND_MAX);
+void Agent::wander(float prob, Rng& rng){
+    float r = rng.uniform();
     if (r < prob){
-        float alpha = 180 * ((float) rand() / (RAND_MAX)) - 90 ; 
+        float alpha = 180 * rng.uniform() - 90 ; 
         turn(alpha);
         computeHeading();
     }
@@ -175,15 +242,15 @@ void Agent::wander(float prob){
 
 void Agent::seek(float x, float y){
     vec2 target(x,y);
-    mVelocity = normalize(target - mPosition);
+    mStore->velocities[mIndex] = normalize(target - mStore->positions[mIndex]);
     computeHeading();
 }
 
 void Agent::setVolume(float f){
-    mSynth->setVolume(f);
+    if(mStore->synths[mIndex]) mStore->synths[mIndex]->setVolume(f);
 };
 
 void Agent::die(){
-    mDead = true;
-    mSynth->stop();
+    mStore->alive[mIndex] = 0;
+    if(mStore->synths[mIndex]) mStore->synths[mIndex]->stop();
 };
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file, memory mapped where the platform allows.
+class MappedFile{
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+        bool open(const std::filesystem::path& path);
+        void close();
+        const uint8_t* data() const;
+        size_t size() const;
+        // reads every page in now, so later readers do not fault to disk
+        void prefault() const;
+
+    private:
+        const uint8_t* mData{nullptr};
+        size_t mSize{0};
+#ifdef _WIN32
+        std::vector<uint8_t> mBytes;
+#endif
+};
+
+MappedFile::~MappedFile(){
+    close();
+}
+
+bool MappedFile::open(const std::filesystem::path& path){
+    close();
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    mBytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    mData = mBytes.data();
+    mSize = mBytes.size();
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0){
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    mData = static_cast<const uint8_t*>(p);
+    mSize = st.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::close(){
+#ifdef _WIN32
+    mBytes.clear();
+#else
+    if (mData) munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+    mData = nullptr;
+    mSize = 0;
+}
+
+const uint8_t* MappedFile::data() const{
+    return mData;
+}
+
+size_t MappedFile::size() const{
+    return mSize;
+}
+
+void MappedFile::prefault() const{
+#ifndef _WIN32
+    if (!mData) return;
+    madvise(const_cast<uint8_t*>(mData), mSize, MADV_WILLNEED);
+    long page = sysconf(_SC_PAGESIZE);
+    volatile uint8_t sink = 0;
+    for (size_t i = 0; i < mSize; i += page) sink = sink + mData[i];
+#endif
+}
+
+// Descriptors, loudness curves and layout of a sliced file, as views into
+// a cache file or into arrays about to be written to one. Rows are
+// segments in file order.
+struct CachedAnalysis{
+    uint64_t numSegments{0};
+    uint64_t numStats{0};// descriptor size
+    uint64_t numFrames{0};// loudness values per segment
+    const double* stats{nullptr};
+    const double* loudness{nullptr};
+    const double* minLoudness{nullptr};
+    const double* maxLoudness{nullptr};
+    const double* projection{nullptr};// 2 per segment
+    const double* positions{nullptr};// grid cell, 2 per segment
+};
+
+// Decoded samples of a file, first channel only, as a view into a
+// mapped cache file.
+struct CachedSource{
+    uint64_t sampleRate{0};
+    uint64_t numFrames{0};
+    const float* samples{nullptr};
+};
+
+// On-disk store of CachedAnalysis keyed by file content and analysis
+// settings. A file is a header followed by the arrays, so a hit is one
+// mmap and the corpus copies straight out of it.
+class AnalysisCache{
+    public:
+        AnalysisCache(std::filesystem::path dir = defaultDirectory());
+        static std::filesystem::path defaultDirectory();
+        static uint64_t hashFile(const std::filesystem::path& file);
+        static uint64_t hash(const void* data, size_t size, uint64_t h = 14695981039346656037ULL);
+        // views stay valid until the next load
+        bool load(uint64_t key, CachedAnalysis& out);
+        bool save(uint64_t key, const CachedAnalysis& in);
+        // sources are mapped into file, which the caller keeps open for as
+        // long as it reads the samples
+        bool loadSource(uint64_t key, MappedFile& file, CachedSource& out);
+        bool saveSource(uint64_t key, const CachedSource& in);
+
+    private:
+        struct Header{
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            uint64_t numSegments;
+            uint64_t numStats;
+            uint64_t numFrames;
+        };
+        struct SourceHeader{
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            uint64_t sampleRate;
+            uint64_t numFrames;
+        };
+        static const uint32_t VERSION = 1;
+        std::filesystem::path path(uint64_t key, const char* extension = "bin") const;
+
+        std::filesystem::path mDir;
+        MappedFile mFile;
+};
+
+AnalysisCache::AnalysisCache(std::filesystem::path dir):mDir(dir){}
+
+std::filesystem::path AnalysisCache::defaultDirectory(){
+    if (const char* home = std::getenv("HOME"))
+        return std::filesystem::path(home) / ".cache" / "brunzit";
+    return std::filesystem::temp_directory_path() / "brunzit";
+}
+
+// FNV-1a, chained through h
+uint64_t AnalysisCache::hash(const void* data, size_t size, uint64_t h){
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++){
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t AnalysisCache::hashFile(const std::filesystem::path& file){
+    MappedFile mapped;
+    if (!mapped.open(file)) return 0;
+    return hash(mapped.data(), mapped.size());
+}
+
+std::filesystem::path AnalysisCache::path(uint64_t key, const char* extension) const{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long)key, extension);
+    return mDir / name;
+}
+
+bool AnalysisCache::load(uint64_t key, CachedAnalysis& out){
+    if (!mFile.open(path(key))) return false;
+    if (mFile.size() < sizeof(Header)) return false;
+    Header h;
+    std::memcpy(&h, mFile.data(), sizeof(Header));
+    if (std::memcmp(h.magic, "BRZC", 4) != 0 || h.version != VERSION || h.key != key) return false;
+    uint64_t n = h.numSegments;
+    uint64_t values = n * (h.numStats + h.numFrames + 2 + 2 + 2);
+    if (mFile.size() != sizeof(Header) + values * sizeof(double)) return false;
+    const double* p = reinterpret_cast<const double*>(mFile.data() + sizeof(Header));
+    out.numSegments = n;
+    out.numStats = h.numStats;
+    out.numFrames = h.numFrames;
+    out.stats = p; p += n * h.numStats;
+    out.loudness = p; p += n * h.numFrames;
+    out.minLoudness = p; p += n;
+    out.maxLoudness = p; p += n;
+    out.projection = p; p += 2 * n;
+    out.positions = p;
+    return true;
+}
+
+// written to a temporary file and renamed, so readers never see half a file
+bool AnalysisCache::save(uint64_t key, const CachedAnalysis& in){
+    std::error_code err;
+    std::filesystem::create_directories(mDir, err);
+    std::filesystem::path target = path(key);
+    std::filesystem::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        Header h{{'B', 'R', 'Z', 'C'}, VERSION, key, in.numSegments, in.numStats, in.numFrames};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        auto write = [&](const double* p, uint64_t count){
+            out.write(reinterpret_cast<const char*>(p), count * sizeof(double));
+        };
+        uint64_t n = in.numSegments;
+        write(in.stats, n * in.numStats);
+        write(in.loudness, n * in.numFrames);
+        write(in.minLoudness, n);
+        write(in.maxLoudness, n);
+        write(in.projection, 2 * n);
+        write(in.positions, 2 * n);
+        if (!out) return false;
+    }
+    std::filesystem::rename(tmp, target, err);
+    return !err;
+}
+
+bool AnalysisCache::loadSource(uint64_t key, MappedFile& file, CachedSource& out){
+    if (!file.open(path(key, "pcm"))) return false;
+    if (file.size() < sizeof(SourceHeader)) return false;
+    SourceHeader h;
+    std::memcpy(&h, file.data(), sizeof(SourceHeader));
+    if (std::memcmp(h.magic, "BRZS", 4) != 0 || h.version != VERSION || h.key != key) return false;
+    if (file.size() != sizeof(SourceHeader) + h.numFrames * sizeof(float)) return false;
+    out.sampleRate = h.sampleRate;
+    out.numFrames = h.numFrames;
+    out.samples = reinterpret_cast<const float*>(file.data() + sizeof(SourceHeader));
+    // the audio thread reads it, which must not wait on the disk
+    file.prefault();
+    return true;
+}
+
+bool AnalysisCache::saveSource(uint64_t key, const CachedSource& in){
+    std::error_code err;
+    std::filesystem::create_directories(mDir, err);
+    std::filesystem::path target = path(key, "pcm");
+    std::filesystem::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        SourceHeader h{{'B', 'R', 'Z', 'S'}, VERSION, key, in.sampleRate, in.numFrames};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(in.samples), in.numFrames * sizeof(float));
+        if (!out) return false;
+    }
+    std::filesystem::rename(tmp, target, err);
+    return !err;
+}
@@ -1,5 +1,5 @@
-#include <random>
 #include <chrono>
+#include <cstdlib>
 
 #include "cinder/app/App.h"
 #include "cinder/app/RendererGl.h"
@@ -22,6 +22,7 @@ class Brunzit : public App {
 	void setup() override;
 	void update() override;
 	void draw() override;
+    void cleanup() override;
     void drawUI();
     Corpus& getCorpus();
     
@@ -39,19 +40,24 @@ class Brunzit : public App {
 
 void Brunzit::setup()
 {
-    std::mt19937_64 rng;
-    uint64_t timeSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::seed_seq ss{uint32_t(timeSeed & 0xffffffff), uint32_t(timeSeed>>32)};
-    rng.seed(ss);
+    // BRUNZIT_SEED replays a session, otherwise the clock picks one
+    uint64_t seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    if (const char* fixed = std::getenv("BRUNZIT_SEED")) seed = std::strtoull(fixed, nullptr, 10);
+    setSessionSeed(seed);
     ImGui::Initialize(ImGui::Options().autoRender(true));
     mCode = std::vector<char>(CODE_SIZE);
     std::fill(mCode.begin(), mCode.end(),'\0');
+    mRuntime.start(SIM_RATE);
 }
 
 void Brunzit::update()
 {
     drawUI();
-    mRuntime.update();
+}
+
+void Brunzit::cleanup()
+{
+    mRuntime.stop();
 }
 
 void Brunzit::drawUI(){
@@ -83,7 +89,9 @@ void Brunzit::drawUI(){
         ImVec4 textColor = ImVec4(1.0, 1.0, 1.0, 0.5f);
         ImGui::Text("World actions:");
         ImGui::Text("make - name num (icon) (color)");
-        ImGui::Text("map - filename");
+        ImGui::Text("map - filename or folder (descriptors, default mfcc: mfcc shape loudness pitch) (mapped)");
+        ImGui::Text("add - filename or folder");
+        ImGui::Text("grains - max");
         ImGui::Text(" ");
         ImGui::Text("Flock actions:");
         ImGui::Text("volume - vol");
@@ -99,8 +107,12 @@ void Brunzit::drawUI(){
         ImGui::Text("left - (freq)");
         ImGui::Text("right - (freq)");
         ImGui::Text("seek - x y (freq)");
+        ImGui::Text("timbre - segment|cluster number (freq)");
         ImGui::Text("wander - prob (freq)");
         ImGui::Text("die - prob (freq)");
+        ImGui::Text(" ");
+        // set BRUNZIT_SEED to this to replay the session
+        ImGui::Text("session seed %llu", (unsigned long long)sessionSeed());
         ImGui::End();
     }
     
@@ -134,6 +146,11 @@ void Brunzit::drawUI(){
         
     }
     ImGui::PopItemWidth();
+    if (mRuntime.isLoading())
+        ImGui::Text("%s %s %d%%", mRuntime.loadingTask(), mRuntime.loadingFile().c_str(),
+                    int(100 * mRuntime.loadProgress()));
+    else if (!mRuntime.loadError().empty())
+        ImGui::Text("%s", mRuntime.loadError().c_str());
     ImGui::PopStyleColor();
     ImGui::PopStyleColor();
     ImGui::PopStyleColor();
@@ -1,20 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
 
 #include <data/FluidIndex.hpp>
 #include <data/FluidMemory.hpp>
 #include <data/TensorTypes.hpp>
 
 #include <data/FluidDataSet.hpp>
-#include <algorithms/public/UMAP.hpp>
-#include <algorithms/public/Grid.hpp>
-#include <algorithms/public/KMeans.hpp>
+#include <algorithms/public/PCA.hpp>
 
 #include "Extractor.hpp"
 #include "Sound.hpp"
+#include "ThreadPool.hpp"
+#include "Projection.hpp"
+#include "AnalysisCache.hpp"
+#include "ImageTerrain.hpp"
+#include "TimbreIndex.hpp"
 
 
 using namespace cinder;
@@ -23,46 +31,134 @@ using namespace fluid;
 using cinder::audio::BufferRef;
 using cinder::audio::SourceFileRef;
 
+// Decoded first channel of one file, segments are views into it
+struct CorpusSource{
+    const float* samples{nullptr};
+    size_t numSamples{0};
+    size_t sampleRate{0};
+    audio::BufferRef buffer;// when decoded into memory
+    MappedFile mapped;// when mapped from the cache
+};
+
 class Corpus{
     public:
+        // 2d projection and grid cell of every segment
+        struct Layout{
+            RealMatrix projection;
+            RealMatrix positions;
+        };
+        // Files analyzed against a live corpus without changing it, merged
+        // into it between ticks by add()
+        struct Addition{
+            std::vector<std::unique_ptr<CorpusSource>> sources;
+            std::vector<Sound> segments;
+            RealMatrix projection;// of the new segments
+            std::unique_ptr<Layout> relayout;// of all segments, after a retrain
+            std::unique_ptr<TimbreIndex> index;// of all segments
+        };
+
         Corpus();
 
-        void addSound(Sound snd);
+        void addSound(Sound&& snd);
         void draw();
-        void project();
+        void prepareDraw();
+        void loadImage(const fs::path& file);
+        void projectLinear();
+        std::unique_ptr<Layout> refine();
+        void setLayout(Layout& layout);
         void findBounds();
-        int getRandom(int cluster);
+        void buildCells();
+        int segmentAt(int x, int y) const;
+        // window positions of the grid cells that sound most like a
+        // segment, or like the centre of a cluster; false when there is
+        // no such segment or cluster
+        bool timbreTargets(bool cluster, int which, vec2 window, std::vector<vec2>& out) const;
+        // any segment of cluster, -1 when there is none
+        int getRandom(int cluster, Rng& rng) const;
         void makeWaves();
         bool empty();
         void makeEnvelope(size_t sampleRate, size_t grainSamples);
-        void slice(audio::BufferRef b, size_t sampleRate);
+        void describe(std::vector<Sound>& segments);
+        void setPool(ThreadPool* pool);
+        void clear();
+        void build(const fs::path& path);
+        std::unique_ptr<Addition> analyze(const fs::path& path);
+        void add(Addition& a);
+        static std::vector<fs::path> audioFiles(const fs::path& path);
+        std::unique_ptr<CorpusSource> loadSource(const fs::path& file, uint64_t content, size_t sampleRate);
+        uint64_t analysisKey(const std::vector<uint64_t>& contents, size_t sampleRate);
+        bool loadAnalysis(uint64_t key, std::vector<Sound>& segments);
+        bool saveAnalysis(uint64_t key, const Layout& layout);
     
         int mEngine{-1};
-        Channel32f mChannel;
+        // increases with every corpus made, newer terrains compare greater
+        const uint64_t mGeneration;
+        // how far build(), analyze() or loadImage() got, 0 to 1
+        std::atomic<float> mProgress{0};
+        // keep the decoded source in a mapped cache file instead of
+        // memory, set by map ... mapped before build and kept for the
+        // files added later; the cache keeps every such file, nothing
+        // evicts them
+        bool mMapSource{false};
+        // what segments are described and laid out by, as named in the
+        // map command; set before build
+        uint32_t mDescriptors{DESC_MFCC};
+        // laid out linearly so far, refine() has the UMAP layout
+        bool mNeedsRefine{false};
+        // set on image terrains
+        std::unique_ptr<ImageTerrain> mImage;
         gl::Texture2dRef mTexture;
         audio::Buffer envelope;
-        map<pair<int, int>,int> mPositionsMap;
+        // row-major (mMaxX+1)*(mMaxY+1) grid, segment at each cell or -1
+        std::vector<int> mCells;
+        // same grid with empty cells holding the nearest occupied segment
+        std::vector<int> mNearestCells;
         int mMinX, mMaxX, mMinY, mMaxY;
     
         float SEGMENT_DUR = 0.2;
         float ENV_DUR{0.1};
-        int ENV_SIZE;
-        float GRAIN_SIZE;
+        int ENV_SIZE{0};
+        float GRAIN_SIZE{0};
         std::vector<Sound> mSounds;
     
 private:
     
     int lastIndex{0};
-    algorithm::UMAP mUmap;
-    algorithm::Grid mGrid;
+    Projection mProjection;
     FluidDataSet<std::string, double, 1> mDataset;
     FluidDataSet<std::string, double, 1> mProjectionDS;
     FluidDataSet<std::string, double, 1> mGridDS;
     RealMatrix mPositions;
+    // nearest segments and clusters in descriptor space, built at map time
+    std::unique_ptr<TimbreIndex> mIndex;
+    static constexpr index NUM_CLUSTERS = 16;
+    static constexpr index TIMBRE_NEIGHBORS = 8;
     
     
+    void cut(const CorpusSource& source, std::vector<Sound>& segments);
+    void addSegments(std::vector<Sound>& segments);
+    void place(const RealMatrix& projection, size_t first);
+    int freeCellNear(int x, int y) const;
+    float morph();
+
+    // in file order, sources added later keep their place
+    std::vector<std::unique_ptr<CorpusSource>> mSources;
+    size_t mSampleRate{0};// of every source, later files are resampled
+    // waves made so far and the grid they were made for
+    size_t mNumWaves{0};
+    int mWaveMaxX{-1}, mWaveMaxY{-1};
+    // where the waves were before the last setLayout, empty when settled
+    std::vector<vec2> mFromPos;
+    vec2 mFromDims;
+    double mMorphStart{0};
+    static constexpr double MORPH_TIME = 1.5;
+    uint64_t mAnalysisKey{0};
+
     double mMaxVal, mMinVal;
-    extractor mExtractor;
+    ThreadPool* mPool{nullptr};
+    AnalysisCache mCache;
+    bool mDrawReady{false};
+    std::vector<std::unique_ptr<extractor>> mExtractors;// one per pool slot
     
     
     
@@ -72,8 +168,13 @@ private:
     
 };
 
-Corpus::Corpus(){
-    mDataset = FluidDataSet<std::string, double, 1>(20);
+uint64_t nextCorpusGeneration(){
+    static std::atomic<uint64_t> generation{0};
+    return ++generation;
+}
+
+Corpus::Corpus():mGeneration(nextCorpusGeneration()){
+    mDataset = FluidDataSet<std::string, double, 1>(2 * extractor::frameSize(mDescriptors));
     mMaxVal = 0;
     mMinVal = 0;
 }
@@ -82,24 +183,43 @@ bool Corpus::empty(){
     return lastIndex == 0;
 }
 
-void Corpus::slice(audio::BufferRef src, size_t sampleRate){
-    size_t numSamples = src->getNumFrames();
-    size_t offset = 0;
-    size_t grainSamples = SEGMENT_DUR * sampleRate;
-    GRAIN_SIZE = grainSamples;
-    makeEnvelope(sampleRate, grainSamples);
-    
+void Corpus::setPool(ThreadPool* pool){
+    mPool = pool;
+    mProjection.setPool(pool);
+    size_t n = pool ? pool->size() : 1;
+    while (mExtractors.size() < n) mExtractors.push_back(std::make_unique<extractor>());
+}
+
+// Appends the GRAIN_SIZE segments of source. Segments are views,
+// nothing is copied.
+void Corpus::cut(const CorpusSource& source, std::vector<Sound>& segments){
+    size_t grainSamples = GRAIN_SIZE;
+    for (size_t offset = 0; offset + grainSamples < source.numSamples; offset += grainSamples)
+        segments.emplace_back(source.samples + offset, grainSamples, source.sampleRate);
+}
+
+// segments have their slot up front, so workers can finish in any order
+// and the corpus still comes out in file order
+void Corpus::describe(std::vector<Sound>& segments){
+    if (mExtractors.empty()) setPool(mPool);
+    std::atomic<size_t> done{0};
+    mProgress = 0.05f;
+    auto analyze = [&](size_t begin, size_t end, size_t slot){
+        for (size_t i = begin; i < end; i++){
+            mExtractors[slot]->extract(segments[i], mDescriptors);
+            mProgress = 0.05f + 0.75f * float(++done) / segments.size();
+        }
+    };
+    if (mPool) mPool->parallelFor(0, segments.size(), 1, analyze);
+    else analyze(0, segments.size(), 0);
+}
+
+void Corpus::addSegments(std::vector<Sound>& segments){
+    for (auto& snd:segments) addSound(std::move(snd));
+    segments.clear();
     mMaxVal = 0;
     mMinVal = 0;
-    
-    while ((offset + grainSamples) < numSamples){
-        audio::Buffer b = audio::Buffer(grainSamples, 1);
-        b.copyOffset(*src.get(), grainSamples, 0, offset);
-        offset += grainSamples;
-        audio::BufferRef dest = std::make_shared<audio::Buffer>(b);
-        Sound snd(dest, sampleRate);
-        mExtractor.extract(snd);
-        addSound(snd);
+    for (auto& snd:mSounds){
         mMaxVal += snd.maxLoudness;
         mMinVal += snd.minLoudness;
     }
@@ -111,29 +231,381 @@ void Corpus::slice(audio::BufferRef src, size_t sampleRate){
     mMinVal -= (range * 0.75);
 }
 
+void Corpus::clear(){
+    mSounds.clear();
+    mSources.clear();
+    mSampleRate = 0;
+    mNumWaves = 0;
+    mFromPos.clear();
+    mNeedsRefine = false;
+    mAnalysisKey = 0;
+    mDataset = FluidDataSet<std::string, double, 1>(2 * extractor::frameSize(mDescriptors));
+    mProjectionDS = FluidDataSet<std::string, double, 1>(2);
+    mGridDS = FluidDataSet<std::string, double, 1>(2);
+    mPositions = RealMatrix();
+    mIndex.reset();
+    mImage.reset();
+    mCells.clear();
+    mNearestCells.clear();
+    lastIndex = 0;
+}
+
+// Replaces the terrain with a file, or with the .wav files of a folder.
+// Analysis and layout come from the cache when the same files were
+// analyzed before with the same settings.
+void Corpus::build(const fs::path& path){
+    clear();
+    mProgress = 0;
+    std::vector<uint64_t> contents;
+    for (auto& file:audioFiles(path)){
+        contents.push_back(AnalysisCache::hashFile(file));
+        mSources.push_back(loadSource(file, contents.back(), mSampleRate));
+        if (mSampleRate == 0) mSampleRate = mSources.back()->sampleRate;
+    }
+    GRAIN_SIZE = size_t(SEGMENT_DUR * mSampleRate);
+    makeEnvelope(mSampleRate, GRAIN_SIZE);
+    std::vector<Sound> segments;
+    for (auto& source:mSources) cut(*source, segments);
+    uint64_t key = analysisKey(contents, mSampleRate);
+    if (key != 0 && loadAnalysis(key, segments)){
+        mIndex = std::make_unique<TimbreIndex>(mDataset, NUM_CLUSTERS, sessionSeed());
+        mEngine = 1;
+        mProgress = 1;
+        return;
+    }
+    describe(segments);
+    addSegments(segments);
+    mIndex = std::make_unique<TimbreIndex>(mDataset, NUM_CLUSTERS, sessionSeed());
+    // playable right away, refine() lays it out properly and saves it
+    projectLinear();
+    mAnalysisKey = key;
+    mNeedsRefine = true;
+    mEngine = 1;
+    mProgress = 1;
+}
+
+// Background side of add(): decodes and describes path against this
+// corpus without changing it, so it can run while the corpus plays.
+// New segments are placed with the trained UMAP. A corpus that came from
+// the cache has no trained model, so it is trained on everything once
+// and the whole terrain is laid out again.
+std::unique_ptr<Corpus::Addition> Corpus::analyze(const fs::path& path){
+    auto a = std::make_unique<Addition>();
+    mProgress = 0;
+    for (auto& file:audioFiles(path)){
+        a->sources.push_back(loadSource(file, AnalysisCache::hashFile(file), mSampleRate));
+        cut(*a->sources.back(), a->segments);
+    }
+    if (a->segments.empty()) return a;
+    describe(a->segments);
+    FluidDataSet<std::string, double, 1> added(mDataset.dims());
+    FluidDataSet<std::string, double, 1> all = mDataset;
+    for (size_t i = 0; i < a->segments.size(); i++){
+        added.add(std::to_string(lastIndex + i), a->segments[i].mfccStats);
+        all.add(std::to_string(lastIndex + i), a->segments[i].mfccStats);
+    }
+    a->index = std::make_unique<TimbreIndex>(all, NUM_CLUSTERS, sessionSeed());
+    if (mProjection.trained()){
+        a->projection = mProjection.transform(added);
+    }
+    else{
+        a->relayout = std::make_unique<Layout>();
+        a->relayout->projection = mProjection.embed(RealMatrix(all.getData()));
+        a->relayout->positions = mProjection.gridPositions(a->relayout->projection);
+    }
+    mProgress = 1;
+    return a;
+}
+
+// Merges an analyzed addition, with nothing reading the corpus but the
+// audio thread, which only reads sources that stay where they are.
+void Corpus::add(Addition& a){
+    size_t first = mSounds.size();
+    for (auto& source:a.sources) mSources.push_back(std::move(source));
+    if (a.segments.empty()) return;
+    addSegments(a.segments);
+    mIndex = std::move(a.index);
+    if (a.relayout) setLayout(*a.relayout);
+    else place(a.projection, first);
+    mDrawReady = false;
+}
+
+// Background side of the progressive layout: UMAP and Grid over the whole
+// corpus, leaving the live layout alone. Saves the analysis with it.
+std::unique_ptr<Corpus::Layout> Corpus::refine(){
+    auto layout = std::make_unique<Layout>();
+    mProgress = 0;
+    layout->projection = mProjection.embed(RealMatrix(mDataset.getData()));
+    mProgress = 0.8f;
+    layout->positions = mProjection.gridPositions(layout->projection);
+    mProgress = 0.95f;
+    if (mAnalysisKey != 0) saveAnalysis(mAnalysisKey, *layout);
+    mProgress = 1;
+    return layout;
+}
+
+// Swaps in a layout for every segment, with nothing reading the corpus
+// but the audio thread. Waves glide from their old cells to the new ones.
+void Corpus::setLayout(Layout& layout){
+    mFromPos.clear();
+    if (mNumWaves == mSounds.size() && !mSounds.empty()){
+        for (auto& snd:mSounds) mFromPos.push_back(snd.mPos);
+        mFromDims = mSounds[0].mDims;
+        mMorphStart = app::getElapsedSeconds();
+    }
+    mProjectionDS = Projection::toDataSet(layout.projection);
+    mGridDS = Projection::toDataSet(layout.positions);
+    mPositions = layout.positions;
+    findBounds();
+    buildCells();
+    mNumWaves = 0;
+    mNeedsRefine = false;
+    mDrawReady = false;
+}
+
+// New segments take the free cell nearest to where their projection falls
+// within the current layout. A full grid grows by whole rows at the
+// bottom, so every existing segment keeps its cell.
+void Corpus::place(const RealMatrix& projection, size_t first){
+    auto projected = mProjectionDS.getData();
+    double lo[2] = {DBL_MAX, DBL_MAX}, hi[2] = {-DBL_MAX, -DBL_MAX};
+    for (index i = 0; i < projected.rows(); i++){
+        for (int d = 0; d < 2; d++){
+            lo[d] = std::min(lo[d], projected(i, d));
+            hi[d] = std::max(hi[d], projected(i, d));
+        }
+    }
+    int cols = mMaxX + 1;
+    index n = projection.rows();
+    RealVector point(2);
+    RealMatrix positions(first + n, 2);
+    for (index i = 0; i < index(first); i++){
+        positions(i, 0) = mPositions(i, 0);
+        positions(i, 1) = mPositions(i, 1);
+    }
+    for (index i = 0; i < n; i++){
+        double u[2];
+        for (int d = 0; d < 2; d++)
+            u[d] = hi[d] > lo[d] ? (projection(i, d) - lo[d]) / (hi[d] - lo[d]) : 0;
+        int x = std::clamp(int(std::round(u[0] * mMaxX)), 0, mMaxX);
+        int y = std::clamp(int(std::round(u[1] * mMaxY)), 0, mMaxY);
+        int cell = freeCellNear(x, y);
+        if (cell < 0){
+            int rows = int((n - i + cols - 1) / cols);
+            mCells.resize(mCells.size() + rows * cols, -1);
+            mMaxY += rows;
+            cell = freeCellNear(x, y);
+        }
+        index segment = first + i;
+        mCells[cell] = int(segment);
+        positions(segment, 0) = cell % cols;
+        positions(segment, 1) = cell / cols;
+        point(0) = projection(i, 0);
+        point(1) = projection(i, 1);
+        mProjectionDS.add(std::to_string(segment), point);
+        point(0) = positions(segment, 0);
+        point(1) = positions(segment, 1);
+        mGridDS.add(std::to_string(segment), point);
+    }
+    mPositions = positions;
+    findBounds();
+    buildCells();
+}
+
+// closest free cell by rings around (x, y), -1 when the grid is full
+int Corpus::freeCellNear(int x, int y) const{
+    int cols = mMaxX + 1, rows = mMaxY + 1;
+    int maxRing = std::max(cols, rows);
+    for (int r = 0; r <= maxRing; r++){
+        for (int cy = y - r; cy <= y + r; cy++){
+            if (cy < 0 || cy >= rows) continue;
+            bool edge = cy == y - r || cy == y + r;
+            for (int cx = x - r; cx <= x + r; cx += edge ? 1 : 2 * r){
+                if (cx >= 0 && cx < cols && mCells[cy * cols + cx] == -1) return cy * cols + cx;
+            }
+        }
+    }
+    return -1;
+}
+
+void Corpus::loadImage(const fs::path& file){
+    mImage = std::make_unique<ImageTerrain>();
+    mImage->open(file, mPool, mProgress);
+    mEngine = 0;
+    mProgress = 1;
+}
+
+// the file itself, or the .wav files of a folder in name order
+std::vector<fs::path> Corpus::audioFiles(const fs::path& path){
+    std::vector<fs::path> files;
+    if (!fs::is_directory(path)) files.push_back(path);
+    else{
+        for (auto& entry:fs::directory_iterator(path))
+            if (entry.path().extension() == ".wav") files.push_back(entry.path());
+        std::sort(files.begin(), files.end());
+    }
+    if (files.empty()) throw std::runtime_error("no .wav files in " + path.string());
+    return files;
+}
+
+// Maps the decoded file from the cache, or decodes it and, with
+// mMapSource, writes it to the cache and maps that instead of keeping the
+// decoded buffer. content is 0 when the file could not be hashed.
+// sampleRate 0 keeps the rate of the file.
+std::unique_ptr<CorpusSource> Corpus::loadSource(const fs::path& file, uint64_t content, size_t sampleRate){
+    auto source = std::make_unique<CorpusSource>();
+    uint64_t rate = sampleRate;
+    uint64_t key = content == 0 ? 0 : AnalysisCache::hash(&rate, sizeof(rate), content);
+    CachedSource cached;
+    if (mMapSource && key != 0 && mCache.loadSource(key, source->mapped, cached)){
+        source->samples = cached.samples;
+        source->numSamples = cached.numFrames;
+        source->sampleRate = cached.sampleRate;
+        return source;
+    }
+    auto src = audio::load(app::loadAsset(file), sampleRate);
+    source->buffer = src->loadBuffer();
+    source->samples = source->buffer->getChannel(0);
+    source->numSamples = source->buffer->getNumFrames();
+    source->sampleRate = src->getSampleRate();
+    if (!mMapSource || key == 0) return source;
+    cached = {source->sampleRate, source->numSamples, source->samples};
+    if (mCache.saveSource(key, cached) && mCache.loadSource(key, source->mapped, cached)){
+        source->samples = cached.samples;
+        source->buffer.reset();
+    }
+    return source;
+}
+
+// content of every file plus everything that changes the analysis, 0 if
+// a file can't be read
+uint64_t Corpus::analysisKey(const std::vector<uint64_t>& contents, size_t sampleRate){
+    if (contents.empty() || std::find(contents.begin(), contents.end(), 0) != contents.end()) return 0;
+    uint64_t content = AnalysisCache::hash(contents.data(), contents.size() * sizeof(uint64_t));
+    const double params[] = {
+        double(SEGMENT_DUR), double(sampleRate),
+        double(extractor::nBins), double(extractor::windowSize), double(extractor::hopSize),
+        double(extractor::nBands), double(extractor::nCoefs),
+        extractor::minFreq, extractor::maxFreq, double(mDescriptors)
+    };
+    return AnalysisCache::hash(params, sizeof(params), content);
+}
 
-void Corpus::addSound(Sound snd){
+bool Corpus::loadAnalysis(uint64_t key, std::vector<Sound>& segments){
+    CachedAnalysis a;
+    if (!mCache.load(key, a)) return false;
+    if (segments.size() != a.numSegments || a.numSegments == 0) return false;
+    mPositions = RealMatrix(a.numSegments, 2);
+    for (size_t i = 0; i < a.numSegments; i++){
+        Sound& snd = segments[i];
+        snd.mfccStats = RealVector(a.numStats);
+        std::copy_n(a.stats + i * a.numStats, a.numStats, snd.mfccStats.begin());
+        snd.loudnessVec = RealVector(a.numFrames);
+        std::copy_n(a.loudness + i * a.numFrames, a.numFrames, snd.loudnessVec.begin());
+        snd.minLoudness = a.minLoudness[i];
+        snd.maxLoudness = a.maxLoudness[i];
+        RealVector point(2);
+        point(0) = a.projection[2 * i];
+        point(1) = a.projection[2 * i + 1];
+        mProjectionDS.add(std::to_string(i), point);
+        point(0) = mPositions(i, 0) = a.positions[2 * i];
+        point(1) = mPositions(i, 1) = a.positions[2 * i + 1];
+        mGridDS.add(std::to_string(i), point);
+    }
+    addSegments(segments);
+    findBounds();
+    buildCells();
+    return true;
+}
+
+bool Corpus::saveAnalysis(uint64_t key, const Layout& layout){
+    size_t n = mSounds.size();
+    if (n == 0) return false;
+    CachedAnalysis a;
+    a.numSegments = n;
+    a.numStats = mSounds[0].mfccStats.size();
+    a.numFrames = mSounds[0].loudnessVec.size();
+    std::vector<double> stats, loudness, minLoudness, maxLoudness, projection, positions;
+    if (layout.positions.rows() != index(n)) return false;
+    for (size_t i = 0; i < n; i++){
+        const Sound& snd = mSounds[i];
+        // the format assumes equal sizes, which equal length segments give
+        if (snd.mfccStats.size() != a.numStats || snd.loudnessVec.size() != a.numFrames)
+            return false;
+        stats.insert(stats.end(), snd.mfccStats.begin(), snd.mfccStats.end());
+        loudness.insert(loudness.end(), snd.loudnessVec.begin(), snd.loudnessVec.end());
+        minLoudness.push_back(snd.minLoudness);
+        maxLoudness.push_back(snd.maxLoudness);
+        projection.push_back(layout.projection(i, 0));
+        projection.push_back(layout.projection(i, 1));
+        positions.push_back(layout.positions(i, 0));
+        positions.push_back(layout.positions(i, 1));
+    }
+    a.stats = stats.data();
+    a.loudness = loudness.data();
+    a.minLoudness = minLoudness.data();
+    a.maxLoudness = maxLoudness.data();
+    a.projection = projection.data();
+    a.positions = positions.data();
+    return mCache.save(key, a);
+}
+
+
+void Corpus::addSound(Sound&& snd){
     mDataset.add(std::to_string(lastIndex++), snd.mfccStats);
-    mSounds.push_back(snd);
+    mSounds.push_back(std::move(snd));
+}
+
+// GL resources are made on the render thread, the rest of a terrain
+// can be built anywhere
+void Corpus::prepareDraw(){
+    if (mDrawReady) return;
+    if (mEngine == 0) mTexture = gl::Texture2d::create(mImage->preview());
+    else if (mEngine == 1) makeWaves();
+    mDrawReady = true;
 }
 
 void Corpus::draw(){
+    prepareDraw();
     if (mEngine == 0){
-        gl::draw( mTexture);
+        gl::draw(mTexture, Rectf(app::getWindowBounds()));
     }
     else if (mEngine == 1){
-        for (auto& snd:mSounds) snd.draw();
+        float t = morph();
+        if (t >= 1){
+            for (auto& snd:mSounds) snd.draw();
+            return;
+        }
+        vec2 dims = glm::mix(mFromDims, mSounds[0].mDims, t);
+        for (size_t i = 0; i < mSounds.size(); i++)
+            mSounds[i].draw(glm::mix(mFromPos[i], mSounds[i].mPos, t), dims);
     }
 }
 
+// eased progress of the glide after setLayout, 1 when there is none
+float Corpus::morph(){
+    if (mFromPos.empty() || mFromPos.size() != mSounds.size()) return 1;
+    float t = float((app::getElapsedSeconds() - mMorphStart) / MORPH_TIME);
+    if (t >= 1){
+        mFromPos.clear();
+        return 1;
+    }
+    return t * t * (3 - 2 * t);
+}
+
+// only sounds added since the last call, unless the grid changed size
 void Corpus::makeWaves(){
+    if (mMaxX != mWaveMaxX || mMaxY != mWaveMaxY) mNumWaves = 0;
     int width = app::getWindowWidth() / (mMaxX + 1);
     int height = app::getWindowHeight() / (mMaxY + 1);
-    for(int i = 0; i < mSounds.size(); i++){
+    for(size_t i = mNumWaves; i < mSounds.size(); i++){
         int x = mPositions(i, 0) * width;
         int y = mPositions(i, 1) * height;
         mSounds[i].makeWave(x, y, width, height, mMinVal, mMaxVal);
     }
+    mNumWaves = mSounds.size();
+    mWaveMaxX = mMaxX;
+    mWaveMaxY = mMaxY;
 }
 
 void Corpus::findBounds(){
@@ -150,15 +622,80 @@ void Corpus::findBounds(){
     }
 }
 
-void Corpus::project(){
-    mProjectionDS = mUmap.train(mDataset);
-    mGridDS = mGrid.process(mProjectionDS);
-    mPositions = RealMatrix(mGridDS.getData());
+// First two principal components of the descriptors, snapped to the
+// grid. Fast enough to play at once while refine() runs.
+void Corpus::projectLinear(){
+    RealMatrix data(mDataset.getData());
+    algorithm::PCA pca;
+    pca.init(data);
+    RealMatrix projected(data.rows(), 2);
+    pca.process(data, projected, 2);
+    mProjectionDS = Projection::toDataSet(projected);
+    mPositions = mProjection.gridPositions(projected);
+    mGridDS = Projection::toDataSet(mPositions);
     findBounds();
+    buildCells();
+}
+
+void Corpus::buildCells(){
+    int cols = mMaxX + 1, rows = mMaxY + 1;
+    mCells.assign(cols * rows, -1);
+    std::vector<int> frontier;
     for (int i = 0; i < mPositions.rows(); i++){
-        pair<int,int> pos = make_pair<int,int>(mPositions(i, 0),mPositions(i, 1));
-        mPositionsMap.insert(pair<pair<int,int>,int>(pos,i));
+        int cell = int(mPositions(i, 1)) * cols + int(mPositions(i, 0));
+        // first segment wins, as the map insert did
+        if (mCells[cell] != -1) continue;
+        mCells[cell] = i;
+        frontier.push_back(cell);
     }
+    // breadth first from every occupied cell at once, so each empty cell
+    // takes the segment of its nearest occupied cell
+    mNearestCells = mCells;
+    for (size_t k = 0; k < frontier.size(); k++){
+        int cell = frontier[k];
+        int x = cell % cols, y = cell / cols;
+        int next[4][2] = {{x - 1, y}, {x + 1, y}, {x, y - 1}, {x, y + 1}};
+        for (auto& n:next){
+            if (n[0] < 0 || n[0] >= cols || n[1] < 0 || n[1] >= rows) continue;
+            int neighbor = n[1] * cols + n[0];
+            if (mNearestCells[neighbor] != -1) continue;
+            mNearestCells[neighbor] = mNearestCells[cell];
+            frontier.push_back(neighbor);
+        }
+    }
+}
+
+// coordinates outside the grid are clamped to it
+int Corpus::segmentAt(int x, int y) const{
+    if (mNearestCells.empty()) return 0;
+    x = std::clamp(x, 0, mMaxX);
+    y = std::clamp(y, 0, mMaxY);
+    return mNearestCells[y * (mMaxX + 1) + x];
+}
+
+bool Corpus::timbreTargets(bool cluster, int which, vec2 window, std::vector<vec2>& out) const{
+    out.clear();
+    if (!mIndex || mMaxX < 0 || mMaxY < 0) return false;
+    RealVector point;
+    if (cluster){
+        if (which < 0 || which >= mIndex->numClusters()) return false;
+        point = mIndex->mean(which);
+    }
+    else{
+        if (which < 0 || which >= int(mSounds.size())) return false;
+        point = mSounds[which].mfccStats;
+    }
+    std::vector<int> nearest;
+    mIndex->nearest(point, TIMBRE_NEIGHBORS, nearest);
+    // centre of the cell, as the waves are drawn
+    vec2 cell(window.x / (mMaxX + 1), window.y / (mMaxY + 1));
+    for (int s:nearest)
+        out.push_back((vec2(mPositions(s, 0), mPositions(s, 1)) + 0.5f) * cell);
+    return !out.empty();
+}
+
+int Corpus::getRandom(int cluster, Rng& rng) const{
+    return mIndex ? mIndex->random(cluster, rng) : -1;
 }
 
 void Corpus:: makeEnvelope(size_t sampleRate, size_t grainSamples){
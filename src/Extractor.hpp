@@ -10,82 +10,179 @@
 #include <algorithms/public/SpectralShape.hpp>
 #include <algorithms/public/MelBands.hpp>
 #include <algorithms/public/DCT.hpp>
+#include <algorithms/public/YINFFT.hpp>
+#include <memory/memory_stack.hpp>
 
+#include <algorithm>
+#include <string>
 #include "Sound.hpp"
 
 using namespace fluid;
 using namespace fluid::algorithm;
 
+// Descriptors a corpus is described by, as bits of a mask. Each adds its
+// mean and standard deviation per segment to the dataset. The mask is
+// chosen by hand for each map, not derived from what behaviours use.
+enum Descriptors : uint32_t{
+    DESC_MFCC = 1,
+    DESC_SHAPE = 2,
+    DESC_LOUDNESS = 4,
+    DESC_PITCH = 8
+};
+
+// Holds the analysis state, so one extractor can run many segments.
+// Not thread safe: each worker uses its own. Only the descriptors asked
+// for are computed; the magnitude spectrum is computed once per frame for
+// all that need it, and loudness always, since waves are drawn from it.
 class extractor{
     public:
 
-        void extract(Sound& snd);
-        RealVector computeStats(fluid::RealMatrixView matrix);
+        void extract(Sound& snd, uint32_t descriptors = DESC_MFCC);
+        // mean and deviation of each column into out, resized only
+        // when its size changes
+        void computeStats(fluid::RealMatrixView matrix, fluid::RealVector& out);
         void normalizeVector(fluid::RealVector& vec);
+        // mask bit for a name, 0 if there is no such descriptor
+        static uint32_t descriptor(const std::string& name);
+        // values per frame, stats per segment are twice as many
+        static fluid::index frameSize(uint32_t descriptors);
+
+        static const fluid::index nBins = 513;
+        static const fluid::index fftSize = 2 * (nBins - 1);
+        static const fluid::index hopSize = 512;
+        static const fluid::index windowSize = 1024;
+        static const fluid::index halfWindow = windowSize / 2;
+        static const fluid::index nBands = 40;
+        static const fluid::index nCoefs = 10;
+        static const fluid::index nShape = 7;
+        // range of the mel bands and of the pitch search, in Hz
+        static constexpr double minFreq = 20;
+        static constexpr double maxFreq = 5000;
+        // scratch for the algorithms of one frame, grows only while
+        // the first frames find out how much they need
+        static const size_t arenaSize = 64 * 1024;
+
+    private:
+        void init(size_t sampleRate);
+
+        STFT          stft{windowSize, fftSize, hopSize};
+        Loudness      loudness{windowSize};
+        MelBands      bands{nBands, fftSize};
+        DCT           dct{nBands, nCoefs};
+        SpectralShape shape{nBins};
+        YINFFT        yin{nBins};
+        size_t        mSampleRate{0};
+        foonathan::memory::memory_stack<> mArena{arenaSize};
+        Allocator     mAlloc{mArena};
+
+        RealVector    mWindow{windowSize};
+        ComplexVector mFrame{nBins};
+        RealVector    mMagnitude{nBins};
+        RealVector    mMels{nBands};
+        RealVector    mMfccs{nCoefs};
+        RealVector    mLoudnessDesc{2};
+        RealVector    mShape{nShape};
+        RealVector    mPitch{2};
+        RealMatrix    mFeatures;// frames by frameSize, grows only
+        MultiStats    mMultiStats;
+        RealMatrix    mStats;// columns by statistics
 };
 
-fluid::RealVector extractor::computeStats(fluid::RealMatrixView matrix)
+uint32_t extractor::descriptor(const std::string& name){
+    if (name == "mfcc") return DESC_MFCC;
+    if (name == "shape") return DESC_SHAPE;
+    if (name == "loudness") return DESC_LOUDNESS;
+    if (name == "pitch") return DESC_PITCH;
+    return 0;
+}
+
+fluid::index extractor::frameSize(uint32_t descriptors){
+    fluid::index size = 0;
+    if (descriptors & DESC_MFCC) size += nCoefs;
+    if (descriptors & DESC_SHAPE) size += nShape;
+    if (descriptors & DESC_LOUDNESS) size += 1;
+    if (descriptors & DESC_PITCH) size += 1;
+    return size;
+}
+
+// filters depend on the sample rate, so they are set up again when it changes
+void extractor::init(size_t sampleRate){
+    if (sampleRate == mSampleRate) return;
+    loudness.init(windowSize, sampleRate);
+    bands.init(minFreq, maxFreq, nBands, nBins, sampleRate, windowSize);
+    dct.init(nBands, nCoefs);
+    mSampleRate = sampleRate;
+}
+
+void extractor::computeStats(fluid::RealMatrixView matrix, fluid::RealVector& out)
 {
-    fluid::algorithm::MultiStats stats;
     fluid::index dim = matrix.cols();
-    fluid::RealMatrix tmp(dim, 7);
-    fluid::RealVector result(dim * 2);
-    stats.process(matrix.transpose(), tmp);
+    if (mStats.rows() != dim) mStats.resize(dim, 7);
+    if (out.size() != dim * 2) out.resize(dim * 2);
+    mMultiStats.process(matrix.transpose(), mStats);
     for (int j = 0; j < dim; j++)
     {
-        result(j*2) = tmp(j, 0);
-        result(j*2 + 1) = tmp(j, 1);
+        out(j*2) = mStats(j, 0);
+        out(j*2 + 1) = mStats(j, 1);
     }
-    return result;
 }
 
-void extractor::extract(Sound& snd){
+// Reads each window straight from the segment, zero padded at the
+// edges as if the segment sat in a buffer with half a window before it.
+// Frame buffers are members and the algorithms take their scratch from
+// an arena that is unwound after every frame, so once warmed up the
+// frame loop does not allocate. The only allocations left are the
+// segment's own loudness and stats, the first time it is extracted.
+// Per-frame values go to mFeatures in mask order.
+void extractor::extract(Sound& snd, uint32_t descriptors){
     using fluid::index;
-    FluidTensor<float, 1> tensor (snd.mBuffer->getChannel(0), snd.mBuffer->getNumFrames());
-    RealVector in(tensor);
-    
-    const fluid::index nBins = 513;
-    const fluid::index fftSize = 2 * (nBins - 1);
-    const fluid::index hopSize = 512;
-    const fluid::index windowSize = 1024;
-    const fluid::index halfWindow = windowSize / 2;
-    const fluid::index nBands = 40;
-    const fluid::index nCoefs = 10;
-    
-    
-    STFT          stft{windowSize, fftSize, hopSize};
-    SpectralShape shape(FluidDefaultAllocator());
-    Loudness      loudness{windowSize};
-    MelBands      bands{nBands, fftSize};
-    DCT           dct{nBands, nCoefs};
-    loudness.init(windowSize, snd.mSampleRate);
-    bands.init(20, 5000, nBands, nBins, snd.mSampleRate, windowSize);
-    dct.init(nBands, nCoefs);
-    RealVector padded(in.size() + windowSize + hopSize);
-    size_t nFrames = floor((padded.size() - windowSize) / hopSize);
-    snd.loudnessVec = RealVector(nFrames);
-    snd.mfccStats = RealVector(nFrames);
-    RealMatrix mfccMat(nFrames, nCoefs);
-    std::fill(padded.begin(), padded.end(), 0);
-    padded(fluid::Slice(halfWindow, in.size())) <<= in;
-    for (int i = 0; i < nFrames; i++)
+    init(snd.mSampleRate);
+    const float* in = snd.mData;
+    index numSamples = snd.mNumFrames;
+    index paddedSize = numSamples + windowSize + hopSize;
+    index nFrames = (paddedSize - windowSize) / hopSize;
+    index size = frameSize(descriptors);
+    bool spectral = descriptors & (DESC_MFCC | DESC_SHAPE | DESC_PITCH);
+    if (snd.loudnessVec.size() != nFrames) snd.loudnessVec.resize(nFrames);
+    if (mFeatures.rows() < nFrames || mFeatures.cols() != size)
+        mFeatures.resize(std::max(nFrames, mFeatures.rows()), size);
+    for (index i = 0; i < nFrames; i++)
     {
-        ComplexVector  frame(nBins);
-        RealVector     magnitude(nBins);
-        RealVector     mels(nBands);
-        RealVector     mfccs(nCoefs);
-        RealVector     loudnessDesc(2);
-        RealVectorView window = padded(fluid::Slice(i * hopSize, windowSize));
-        stft.processFrame(window, frame);
-        stft.magnitude(frame, magnitude);
-        bands.processFrame(magnitude, mels, false, false, true, FluidDefaultAllocator());
-        dct.processFrame(mels, mfccs);
-        mfccMat.row(i) <<= mfccs;
-        loudness.processFrame(window, loudnessDesc, false, false);
-        snd.loudnessVec(i) = loudnessDesc(0);
+        auto marker = mArena.top();
+        index start = i * hopSize - halfWindow;
+        for (index k = 0; k < windowSize; k++){
+            index src = start + k;
+            mWindow(k) = (src >= 0 && src < numSamples) ? in[src] : 0;
+        }
+        loudness.processFrame(mWindow, mLoudnessDesc, false, false);
+        snd.loudnessVec(i) = mLoudnessDesc(0);
+        if (spectral){
+            stft.processFrame(mWindow, mFrame);
+            stft.magnitude(mFrame, mMagnitude);
+        }
+        auto features = mFeatures.row(i);
+        index col = 0;
+        if (descriptors & DESC_MFCC){
+            bands.processFrame(mMagnitude, mMels, false, false, true, mAlloc);
+            dct.processFrame(mMels, mMfccs);
+            features(Slice(col, nCoefs)) <<= mMfccs;
+            col += nCoefs;
+        }
+        if (descriptors & DESC_SHAPE){
+            shape.processFrame(mMagnitude, mShape, snd.mSampleRate, 0, -1, 0.95, false, false,
+                               mAlloc);
+            features(Slice(col, nShape)) <<= mShape;
+            col += nShape;
+        }
+        if (descriptors & DESC_LOUDNESS) features(col++) = mLoudnessDesc(0);
+        if (descriptors & DESC_PITCH){
+            yin.processFrame(mMagnitude, mPitch, minFreq, maxFreq, snd.mSampleRate, mAlloc);
+            features(col++) = mPitch(0);
+        }
+        mArena.unwind(marker);
     }
     
-    snd.mfccStats = computeStats(mfccMat);
+    computeStats(mFeatures(Slice(0, nFrames), Slice(0)), snd.mfccStats);
     snd.minLoudness = *std::min_element(
                     snd.loudnessVec.begin(),
                     snd.loudnessVec.end()
@@ -1,14 +1,40 @@
 #pragma once
 
 #include <list>
+#include <array>
+#include <cfloat>
+#include <numeric>
+#include "SpatialGrid.hpp"
+#include "NeighborKernel.hpp"
+#include "ThreadPool.hpp"
+#include "WorldIndex.hpp"
+#include "VoicePool.hpp"
 
 using std::list;
 using std::string;
 
+static const size_t AGENTS_PER_TASK = 128;
+
+enum class NeighborRule{avoid, join, align};
+
+// neighbor rules evaluated together by Flock::boids, in action order
+struct NeighborRules{
+    struct Rule{
+        NeighborRule type;
+        float threshold;
+        float strength;
+    };
+    std::array<Rule, 3> rules;
+    size_t count{0};
+    void add(NeighborRule type, float threshold, float strength){
+        rules[count++] = {type, threshold, strength};
+    }
+};
 
 class Flock {
 public:
-    Flock(int num, string icon, string color, Corpus* c);
+    // agents start anywhere in bounds; without voices the flock is silent
+    Flock(int num, string icon, string color, Corpus* c, VoicePool* voices, Rng rng, vec2 bounds);
     void update();
     void go(float m, int freq = 3);
     void turn(float m, int freq = 0);
@@ -21,55 +47,95 @@ public:
     void volume(float v, int freq = 0);
     void wander(float p, int freq = 1);
     void seek(float x, float y, int freq = 0);
-    void avoid(float threshold, float strength, string target, int freq = 3);
-    void join(float threshold, float strength, string target, int freq = 3);
-    void align(float threshold, float strength, string target, int freq = 3);
+    void timbre(const std::vector<vec2>& targets, int freq = 0);
+    void avoid(float threshold, float strength, const NeighborSource* target, int freq = 3);
+    void join(float threshold, float strength, const NeighborSource* target, int freq = 3);
+    void align(float threshold, float strength, const NeighborSource* target, int freq = 3);
+    void boids(const NeighborRules& rules, const NeighborSource* target);
+    bool evalFreq(int freq);
+    void index(float cellSize, bool useGrid = true);
+    void setBounds(vec2 bounds);
+    void setTimeScale(float scale);
+    void setPool(ThreadPool* pool);
+    void setCorpus(Corpus* c);
+    void compact();
+    void release();
+    Agent agent(size_t i);
+    const AgentStore& store();
+    NeighborSource source();
+    size_t size();
     void print();
-    void draw();
     
 private:
     vec2 seek(vec2 target, vec2 pos, vec2 vel);
-    bool evalFreq(int freq);
+    vec2 separation(vec2 sum, int count, vec2 vel);
+    vec2 cohesion(vec2 sum, int count, vec2 pos, vec2 vel);
+    vec2 alignment(vec2 sum, int count, vec2 vel);
+    void refreshIndex();
+    template<typename F> void forAgents(const NeighborSource* target, F&& fn);
+    template<typename F> void forNeighbors(const NeighborSource& src, size_t i, float threshold,
+                                           kernel::Neighbor* scratch, F&& visit);
 
-    std::list<std::shared_ptr<Agent>> mAgents;
+    AgentStore mAgents;
+    SpatialGrid mGrid;
+    std::vector<int> mAllIndices;
+    std::vector<std::vector<kernel::Neighbor>> mScratch;
+    kernel::NeighborKernel mKernel{kernel::selectNeighborKernel()};
+    Rng mRng;// only used by the task running this flock
+    ThreadPool* mPool{nullptr};
+    VoicePool* mVoices;
+    size_t mDead{0};
+    vec2 mBounds{1, 1};
+    float mCellSize{50};
+    bool mUseGrid{true};
+    bool mIndexDirty{true};
     float mMaxSpeed{4};
     float mMaxForce{0.05};
 };
 
-Flock::Flock(int num, string icon, string color, Corpus* c){
-    int width = app::getWindowWidth();
-    int height = app::getWindowHeight();
+Flock::Flock(int num, string icon, string color, Corpus* c, VoicePool* voices, Rng rng, vec2 bounds):
+    mRng(rng), mVoices(voices){
+    float width = bounds.x;
+    float height = bounds.y;
+    mAgents.icon = icon;
+    color[0] = toupper(color[0]);
+    mAgents.color = svgNameToRgb(color.c_str());
+    mAgents.maxSpeed = mMaxSpeed;
+    setBounds(bounds);
+    mAgents.reserve(num);
     for(int i = 0; i < num; i++){
-        float x =  width * (float) rand() / (RAND_MAX);
-        float y =  height * (float) rand() / (RAND_MAX);
-        float dx =   (float) rand() / (RAND_MAX);
-        float dy =  (float) rand() / (RAND_MAX);
-        mAgents.push_back(
-            std::make_shared<Agent>(
-                vec2(x,y), vec2(dx, dy), icon, color, c
-            )
-        );
+        float x =  width * mRng.uniform();
+        float y =  height * mRng.uniform();
+        float dx =   mRng.uniform();
+        float dy =  mRng.uniform();
+        mAgents.add(vec2(x,y), vec2(dx, dy), mVoices ? mVoices->acquire(c) : nullptr);
     }
     float vol = 0.05 / float(num);
-    for( auto& a : mAgents){
-        a->setVolume(vol);
+    for(size_t i = 0; i < size(); i++){
+        agent(i).setVolume(vol);
     }
 }
 
-void Flock::draw(){
-    for( auto& a : mAgents){
-       a->draw();
-    }
+Agent Flock::agent(size_t i){
+    return Agent(&mAgents, i);
+}
+
+const AgentStore& Flock::store(){
+    return mAgents;
+}
+
+size_t Flock::size(){
+    return mAgents.size();
 }
 
 void Flock::print(){
-    for( auto& a : mAgents){
-        std::cout<<a->getVelocity()<<std::endl;
+    for(auto& v : mAgents.velocities){
+        std::cout<<v<<std::endl;
     }
 }
 
 bool Flock::evalFreq(int freq){
-    float dice = (float) rand() / (RAND_MAX);
+    float dice = mRng.uniform();
     switch (freq){
         case(0): return true; //once, will be removed
         case(1): return dice < 0.3; // sometimes
@@ -81,128 +147,302 @@ bool Flock::evalFreq(int freq){
 }
 
 void Flock::wander(float p, int freq){
-    for( auto& a : mAgents) if(evalFreq(freq)) a->wander(p);
+    // keep the turn rate per second when ticks are shorter than a frame
+    if (freq != 0) p = 1 - std::pow(1 - p, mAgents.timeScale);
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).wander(p, mRng);
 }
 
 void Flock::go(float m, int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->go(m);
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).go(m);
+    mIndexDirty = true;
 }
 
 void Flock::turn(float m, int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->turn(m);
+    if (freq != 0) m *= mAgents.timeScale;
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).turn(m);
 }
 
 void Flock::up(int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->up();
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).up();
 }
 
 void Flock::down(int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->down();
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).down();
 }
 
 void Flock::left(int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->left();
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).left();
 }
 
 void Flock::right(int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->right();
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).right();
 }
 
 void Flock::stop(int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->stop();
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).stop();
+    mIndexDirty = true;
 }
 
 void Flock::die(float p, int freq){
-    for( auto& a : mAgents)
-        if(evalFreq(freq) && ((float) rand() / (RAND_MAX)) < p)
-            a->die();
+    // keep the death rate per second when ticks are shorter than a frame
+    if (freq != 0) p = 1 - std::pow(1 - p, mAgents.timeScale);
+    for(size_t i = 0; i < size(); i++)
+        if(evalFreq(freq) && mRng.uniform() < p && agent(i).isAlive()){
+            agent(i).die();
+            mDead++;
+        }
+}
+
+// drops agents that died in earlier ticks and recycles their voices
+void Flock::compact(){
+    if (mDead == 0) return;
+    mAgents.compact([this](SynthRef s){if (mVoices) mVoices->release(std::move(s));});
+    mDead = 0;
+    mIndexDirty = true;
+}
+
+// gives every voice back to the pool, used when the flock is replaced
+void Flock::release(){
+    if (mVoices) for (auto& s:mAgents.synths) mVoices->release(std::move(s));
+    mAgents.alive.assign(size(), 0);
+    mDead = size();
+    compact();
 }
 
 
 void Flock::volume(float p, int freq){
-    float vol = p / mAgents.size();
+    float vol = p / size();
 
-    for( auto& a : mAgents) if(evalFreq(freq)){
-        a->setVolume(vol);
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)){
+        agent(i).setVolume(vol);
     };
 }
 
 
-void die(float p, int freq = 0);
-void volume(float v, int freq = 0);
-
-
 void Flock::seek(float x, float y, int freq){
-    for( auto& a : mAgents) if(evalFreq(freq))a->seek(x, y);
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)) agent(i).seek(x, y);
 }
 
-
-void Flock::avoid(float threshold, float strength, string target, int freq){
-    if(!evalFreq(freq))return;
-    vec2 steer(0,0);
-    int count = 0;
-    for( auto& a1 :mAgents) {
-        for( auto& a2 :mAgents) {
-            vec2 diff = a1->getPosition() - a2->getPosition();
-            float dist = length(diff);
-            if (dist >0 && dist < threshold){
-                steer += (normalize(diff) / dist);
-                count++;
+// each agent seeks the closest of targets
+void Flock::timbre(const std::vector<vec2>& targets, int freq){
+    if (targets.empty()) return;
+    for(size_t i = 0; i < size(); i++) if(evalFreq(freq)){
+        vec2 pos = mAgents.positions[i];
+        vec2 best = targets[0];
+        float bestDist = FLT_MAX;
+        for (const vec2& t:targets){
+            vec2 d = t - pos;
+            float dist = dot(d, d);
+            if (dist < bestDist){
+                bestDist = dist;
+                best = t;
             }
         }
-        if (count > 0) {
-            steer /= (float)count;
-        }
-        if (length(steer)> 0) {
-              steer = normalize(steer) * mMaxSpeed;
-              steer -= a1->getVelocity();
-            float mag = length(steer);
-            if (mag > mMaxForce) steer *= (mMaxForce/mag);
-        }
-        a1->applyForce( steer * strength);
+        agent(i).seek(best.x, best.y);
     }
 }
 
-void Flock::join(float threshold, float strength, string target, int freq){
-    if(!evalFreq(freq))return;
-    vec2 centroid(0,0);
-    int count = 0;
-    for( auto& a1 :mAgents) {
-        for( auto& a2 :mAgents) {
-            float dist = distance(a1->getPosition(), a2->getPosition());
-            if (dist >0 && dist < threshold){
-                centroid += a2->getPosition();
-                count++;
-            }
-        }
-        if (count > 0) {
-            centroid /= (float)count;
-            a1->applyForce(seek(centroid, a1->getPosition(), a1->getVelocity()) * strength);
+void Flock::setBounds(vec2 bounds){
+    mBounds = bounds;
+    mAgents.bounds = bounds;
+}
+
+void Flock::setTimeScale(float scale){
+    mAgents.timeScale = scale;
+}
+
+void Flock::setPool(ThreadPool* pool){
+    mPool = pool;
+}
+
+// synths keep their engine, they only read from the new terrain
+void Flock::setCorpus(Corpus* c){
+    for (auto& s:mAgents.synths)
+        if (s) s->setCorpus(c);
+}
+
+void Flock::index(float cellSize, bool useGrid){
+    mCellSize = cellSize;
+    mUseGrid = useGrid;
+    mIndexDirty = true;
+    if (mAllIndices.size() != size()){
+        mAllIndices.resize(size());
+        std::iota(mAllIndices.begin(), mAllIndices.end(), 0);
+    }
+    if (!mUseGrid) return;
+    mGrid.build(mAgents.positions, mCellSize, mBounds);
+    mIndexDirty = false;
+}
+
+void Flock::refreshIndex(){
+    if (mIndexDirty) index(mCellSize, mUseGrid);
+}
+
+NeighborSource Flock::source(){
+    return {mAgents.positions.data(), mAgents.velocities.data(),
+            mAgents.alive.data(), mAllIndices.data(), size(),
+            mUseGrid ? &mGrid : nullptr};
+}
+
+// Runs fn(i, src, scratch) for every live agent, where src is the target
+// flock snapshot or this flock when target is null. Agents are split in
+// ranges across the pool. Rules only read positions/velocities and write
+// the acceleration of agent i, so the result does not depend on the split.
+template<typename F>
+void Flock::forAgents(const NeighborSource* target, F&& fn){
+    if (target == nullptr) refreshIndex();
+    if (mScratch.empty()) mScratch.resize(mPool ? mPool->size() : 1);
+    NeighborSource src = target ? *target : source();
+    for (auto& s:mScratch) if (s.size() < src.size) s.resize(src.size);
+    auto range = [&](size_t begin, size_t end, size_t slot){
+        kernel::Neighbor* scratch = mScratch[slot].data();
+        for (size_t i = begin; i < end; i++)
+            if (mAgents.alive[i]) fn(i, src, scratch);
+    };
+    if (mPool) mPool->parallelFor(0, size(), AGENTS_PER_TASK, range);
+    else range(0, size(), 0);
+}
+
+// visit(j, diff, dist) for every live agent j of src within threshold of
+// agent i, diff is the shortest displacement from i to j on the torus of
+// Agent::wrap
+template<typename F>
+void Flock::forNeighbors(const NeighborSource& src, size_t i, float threshold,
+                         kernel::Neighbor* scratch, F&& visit){
+    const float* xy = reinterpret_cast<const float*>(src.positions);
+    vec2 pos = mAgents.positions[i];
+    auto test = [&](const int* items, size_t n){
+        size_t found = mKernel(xy, items, n, pos.x, pos.y, threshold,
+                               mBounds.x, mBounds.y, scratch);
+        for (size_t k = 0; k < found; k++){
+            const kernel::Neighbor& nb = scratch[k];
+            if (src.alive[nb.index]) visit(size_t(nb.index), nb.diff, nb.dist);
         }
+    };
+    if (src.grid) src.grid->querySpans(pos, threshold, test);
+    else test(src.all, src.size);
+}
+
+vec2 Flock::separation(vec2 steer, int count, vec2 vel){
+    if (count > 0) {
+        steer /= (float)count;
     }
+    if (length(steer)> 0) {
+        steer = normalize(steer) * mMaxSpeed;
+        steer -= vel;
+        float mag = length(steer);
+        if (mag > mMaxForce) steer *= (mMaxForce/mag);
+    }
+    return steer;
+}
+
+vec2 Flock::cohesion(vec2 centroid, int count, vec2 pos, vec2 vel){
+    if (count == 0) return vec2(0,0);
+    centroid /= (float)count;
+    return seek(centroid, pos, vel);
 }
 
-void Flock::align(float threshold, float strength, string target, int freq){
+vec2 Flock::alignment(vec2 centroid, int count, vec2 vel){
+    if (count == 0) return vec2(0,0);
+    centroid /= (float)count;
+    centroid = normalize(centroid);
+    vec2 steer = centroid - vel;
+    float mag = length(steer);
+    if (mag > mMaxForce) steer *= (mMaxForce/mag);
+    return steer;
+}
+
+void Flock::avoid(float threshold, float strength, const NeighborSource* target, int freq){
     if(!evalFreq(freq))return;
-    vec2 centroid(0,0);
-    int count = 0;
-    for( auto& a1 :mAgents) {
-        for( auto& a2 :mAgents) {
-            float dist = distance(a1->getPosition(), a2->getPosition());
-            if (dist >0 && dist < threshold){
-                centroid += a2->getVelocity();
-                count++;
+    vec2* velocities = mAgents.velocities.data();
+    vec2* accelerations = mAgents.accelerations.data();
+    forAgents(target, [&](size_t i, const NeighborSource& src, kernel::Neighbor* scratch) {
+        vec2 steer(0,0);
+        int count = 0;
+        forNeighbors(src, i, threshold, scratch, [&](size_t j, vec2 diff, float dist){
+            steer -= (diff / dist) / dist;
+            count++;
+        });
+        accelerations[i] += separation(steer, count, velocities[i]) * strength;
+    });
+}
+
+void Flock::join(float threshold, float strength, const NeighborSource* target, int freq){
+    if(!evalFreq(freq))return;
+    const vec2* positions = mAgents.positions.data();
+    vec2* velocities = mAgents.velocities.data();
+    vec2* accelerations = mAgents.accelerations.data();
+    forAgents(target, [&](size_t i, const NeighborSource& src, kernel::Neighbor* scratch) {
+        vec2 centroid(0,0);
+        int count = 0;
+        forNeighbors(src, i, threshold, scratch, [&](size_t j, vec2 diff, float dist){
+            centroid += positions[i] + diff;
+            count++;
+        });
+        if (count > 0)
+            accelerations[i] += cohesion(centroid, count, positions[i], velocities[i]) * strength;
+    });
+}
+
+void Flock::align(float threshold, float strength, const NeighborSource* target, int freq){
+    if(!evalFreq(freq))return;
+    vec2* velocities = mAgents.velocities.data();
+    vec2* accelerations = mAgents.accelerations.data();
+    forAgents(target, [&](size_t i, const NeighborSource& src, kernel::Neighbor* scratch) {
+        vec2 centroid(0,0);
+        int count = 0;
+        forNeighbors(src, i, threshold, scratch, [&](size_t j, vec2 diff, float dist){
+            centroid += src.velocities[j];
+            count++;
+        });
+        if (count > 0)
+            accelerations[i] += alignment(centroid, count, velocities[i]) * strength;
+    });
+}
+
+// Single neighbor sweep feeding several rules. The grid is built with the
+// largest threshold as cell size, so every rule visits the same cells in the
+// same order and the sums match running the rules one by one.
+void Flock::boids(const NeighborRules& rules, const NeighborSource* target){
+    const vec2* positions = mAgents.positions.data();
+    vec2* velocities = mAgents.velocities.data();
+    vec2* accelerations = mAgents.accelerations.data();
+    float radius = 0;
+    for (size_t r = 0; r < rules.count; r++)
+        radius = std::max(radius, rules.rules[r].threshold);
+
+    forAgents(target, [&](size_t i, const NeighborSource& src, kernel::Neighbor* scratch) {
+        std::array<vec2, 3> sums;
+        std::array<int, 3> counts{0, 0, 0};
+        sums.fill(vec2(0,0));
+        forNeighbors(src, i, radius, scratch, [&](size_t j, vec2 diff, float dist){
+            for (size_t r = 0; r < rules.count; r++){
+                if (dist >= rules.rules[r].threshold) continue;
+                switch(rules.rules[r].type){
+                    case NeighborRule::avoid: sums[r] -= (diff / dist) / dist; break;
+                    case NeighborRule::join: sums[r] += positions[i] + diff; break;
+                    case NeighborRule::align: sums[r] += src.velocities[j]; break;
+                }
+                counts[r]++;
+            }
+        });
+        for (size_t r = 0; r < rules.count; r++){
+            const NeighborRules::Rule& rule = rules.rules[r];
+            switch(rule.type){
+                case NeighborRule::avoid:
+                    accelerations[i] += separation(sums[r], counts[r], velocities[i]) * rule.strength;
+                    break;
+                case NeighborRule::join:
+                    if (counts[r] > 0)
+                        accelerations[i] += cohesion(sums[r], counts[r], positions[i], velocities[i]) * rule.strength;
+                    break;
+                case NeighborRule::align:
+                    if (counts[r] > 0)
+                        accelerations[i] += alignment(sums[r], counts[r], velocities[i]) * rule.strength;
+                    break;
             }
         }
-        if (count > 0) {
-            centroid /= (float)count;
-            centroid = normalize(centroid);
-            vec2 steer = centroid - a1->getVelocity();
-            float mag = length(steer);
-            if (mag > mMaxForce) steer *= (mMaxForce/mag);
-            a1->applyForce(steer * strength);
-        }
-    }
+    });
 }
 
 vec2 Flock::seek(vec2 target, vec2 pos, vec2 vel) {
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include "cinder/gl/gl.h"
+
+using namespace cinder;
+using std::string;
+
+// seconds on the clock shared by the simulation and render threads
+double frameClock(){
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Drawable state of one flock, published by the simulation thread
+// with its positions before and after a tick.
+struct FlockFrame{
+    string icon;
+    Color color;
+    std::vector<vec2> previous;
+    std::vector<vec2> current;
+    std::vector<float> headings;
+    std::vector<uint8_t> alive;
+    void draw(float alpha, vec2 bounds) const;
+};
+
+struct WorldFrame{
+    std::vector<FlockFrame> flocks;
+    vec2 bounds{1, 1};
+    double time{0};
+    double tick{1};
+    void draw(double now) const;
+};
+
+void FlockFrame::draw(float alpha, vec2 bounds) const{
+    size_t n = std::min(previous.size(), current.size());
+    for (size_t i = 0; i < n; i++){
+        if (!alive[i]) continue;
+        // interpolate along the shortest path so wrapping agents don't
+        // cross the whole window
+        vec2 d = current[i] - previous[i];
+        d.x -= bounds.x * std::round(d.x / bounds.x);
+        d.y -= bounds.y * std::round(d.y / bounds.y);
+        vec2 pos = previous[i] + d * alpha;
+        pos.x -= bounds.x * std::floor(pos.x / bounds.x);
+        pos.y -= bounds.y * std::floor(pos.y / bounds.y);
+        gl::pushModelMatrix();
+        gl::translate(pos);
+        gl::rotate(headings[i]);
+        gl::drawString(icon, {0,0}, color);
+        gl::popModelMatrix();
+    }
+}
+
+// draws the last tick interpolated by how far we are into the next one
+void WorldFrame::draw(double now) const{
+    float alpha = std::clamp(float((now - time) / tick), 0.0f, 1.0f);
+    for (auto& f:flocks) f.draw(alpha, bounds);
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cinder/Channel.h"
+#include "cinder/ImageIo.h"
+
+#include "AnalysisCache.hpp"
+#include "ThreadPool.hpp"
+
+using namespace cinder;
+
+// Grey image terrain kept as a pyramid of square float tiles in cache
+// files, one mapped file per level, so images far larger than memory or
+// a texture still load. Only the tiles agents sample are paged in. The
+// image is stretched over the window; an agent samples the level whose
+// texels are about as wide as its step, so fast agents read the average
+// of what they pass over instead of aliasing.
+class ImageTerrain{
+    public:
+        static constexpr int32_t TILE = 256;// texels per tile side
+        // pyramids are cached in dir
+        ImageTerrain(std::filesystem::path dir = AnalysisCache::defaultDirectory());
+        // converts file into the cache on a miss
+        void open(const std::filesystem::path& file, ThreadPool* pool, std::atomic<float>& progress);
+        // grey value at pos in bounds the image is stretched over,
+        // averaged over a step of speed units
+        float sample(vec2 pos, vec2 bounds, float speed) const;
+        // the largest level that fits a texture of DRAW_SIZE
+        const Channel32f& preview() const;
+        size_t numLevels() const;
+
+    private:
+        struct Level{
+            int32_t width{0};
+            int32_t height{0};
+            int32_t tilesX{0};
+            std::unique_ptr<MappedFile> file;
+            const float* texels{nullptr};
+        };
+        struct Header{
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            uint32_t level;
+            int32_t width;
+            int32_t height;
+            int32_t tile;
+        };
+        class BandWriter;
+        static constexpr uint32_t VERSION = 1;
+        static constexpr int32_t DRAW_SIZE = 2048;
+        static void writeBand(std::ostream& out, const float* rows, int32_t width, int32_t valid);
+        std::filesystem::path path(uint64_t key, size_t level) const;
+        bool openLevel(uint64_t key, uint32_t level);
+        void convert(const std::filesystem::path& file, uint64_t key, std::atomic<float>& progress);
+        void downsample(uint64_t key, ThreadPool* pool);
+        float texel(const Level& l, int32_t x, int32_t y) const;
+        void makePreview();
+
+        std::vector<Level> mLevels;
+        Channel32f mPreview;
+        std::filesystem::path mDir;
+};
+
+ImageTerrain::ImageTerrain(std::filesystem::path dir):mDir(dir){}
+
+// Receives decoded rows in order and writes each band of TILE rows as a
+// row of tiles, so only one band is ever in memory.
+class ImageTerrain::BandWriter: public ImageTarget{
+    public:
+        BandWriter(std::ostream& out, int32_t width, int32_t height, std::atomic<float>& progress);
+        void* getRowPointer(int32_t row) override;
+        void finish();
+
+    private:
+        std::ostream& mOut;
+        std::vector<float> mRows;
+        int32_t mBand{0};
+        bool mFinished{false};
+        std::atomic<float>& mProgress;
+};
+
+ImageTerrain::BandWriter::BandWriter(std::ostream& out, int32_t width, int32_t height, std::atomic<float>& progress):
+    mOut(out), mRows(size_t(width) * TILE), mProgress(progress){
+    setSize(width, height);
+    setColorModel(ImageIo::CM_GRAY);
+    setDataType(ImageIo::FLOAT32);
+    setChannelOrder(ImageIo::Y);
+}
+
+void* ImageTerrain::BandWriter::getRowPointer(int32_t row){
+    int32_t band = row / TILE;
+    if (band < mBand) throw std::runtime_error("image rows out of order");
+    if (band != mBand){
+        writeBand(mOut, mRows.data(), getWidth(), TILE);
+        mBand = band;
+    }
+    // level 0 is most of the work
+    mProgress = 0.75f * row / getHeight();
+    return mRows.data() + size_t(row % TILE) * getWidth();
+}
+
+void ImageTerrain::BandWriter::finish(){
+    if (mFinished) return;
+    writeBand(mOut, mRows.data(), getWidth(), getHeight() - mBand * TILE);
+    mFinished = true;
+}
+
+// tiles past the edge of the image repeat its last row and column
+void ImageTerrain::writeBand(std::ostream& out, const float* rows, int32_t width, int32_t valid){
+    std::vector<float> tile(TILE * TILE);
+    int32_t tilesX = (width + TILE - 1) / TILE;
+    for (int32_t tx = 0; tx < tilesX; tx++){
+        for (int32_t r = 0; r < TILE; r++){
+            const float* row = rows + size_t(std::min(r, valid - 1)) * width;
+            for (int32_t c = 0; c < TILE; c++)
+                tile[r * TILE + c] = row[std::min(tx * TILE + c, width - 1)];
+        }
+        out.write(reinterpret_cast<const char*>(tile.data()), tile.size() * sizeof(float));
+    }
+}
+
+std::filesystem::path ImageTerrain::path(uint64_t key, size_t level) const{
+    char name[40];
+    std::snprintf(name, sizeof(name), "%016llx.t%zu", (unsigned long long)key, level);
+    return mDir / name;
+}
+
+// Levels halve down to a single tile. A cached pyramid is used as is,
+// otherwise the image is decoded once, band by band, and every level is
+// made from the mapped one above it.
+void ImageTerrain::open(const std::filesystem::path& file, ThreadPool* pool, std::atomic<float>& progress){
+    mLevels.clear();
+    uint64_t content = AnalysisCache::hashFile(file);
+    uint32_t params[2] = {VERSION, uint32_t(TILE)};
+    uint64_t key = AnalysisCache::hash(params, sizeof(params), content);
+    bool cached = content != 0 && openLevel(key, 0);
+    while (cached && (mLevels.back().width > TILE || mLevels.back().height > TILE))
+        cached = openLevel(key, uint32_t(mLevels.size()));
+    if (!cached){
+        mLevels.clear();
+        convert(file, key, progress);
+        while (mLevels.back().width > TILE || mLevels.back().height > TILE){
+            downsample(key, pool);
+            progress = 0.75f + 0.25f * (1 - float(mLevels.back().width) / mLevels[0].width);
+        }
+    }
+    makePreview();
+    progress = 1;
+}
+
+bool ImageTerrain::openLevel(uint64_t key, uint32_t level){
+    Level l;
+    l.file = std::make_unique<MappedFile>();
+    if (!l.file->open(path(key, level)) || l.file->size() < sizeof(Header)) return false;
+    Header h;
+    std::memcpy(&h, l.file->data(), sizeof(Header));
+    if (std::memcmp(h.magic, "BRZI", 4) != 0 || h.version != VERSION || h.key != key ||
+        h.level != level || h.tile != TILE || h.width <= 0 || h.height <= 0) return false;
+    l.width = h.width;
+    l.height = h.height;
+    l.tilesX = (h.width + TILE - 1) / TILE;
+    size_t tilesY = (h.height + TILE - 1) / TILE;
+    if (l.file->size() != sizeof(Header) + l.tilesX * tilesY * TILE * TILE * sizeof(float)) return false;
+    l.texels = reinterpret_cast<const float*>(l.file->data() + sizeof(Header));
+    mLevels.push_back(std::move(l));
+    return true;
+}
+
+// written to a temporary file and renamed, as the analysis cache does
+void ImageTerrain::convert(const std::filesystem::path& file, uint64_t key, std::atomic<float>& progress){
+    ImageSourceRef source = cinder::loadImage(file);
+    std::error_code err;
+    std::filesystem::create_directories(mDir, err);
+    std::filesystem::path target = path(key, 0);
+    std::filesystem::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot write " + tmp.string());
+        Header h{{'B', 'R', 'Z', 'I'}, VERSION, key, 0, source->getWidth(), source->getHeight(), TILE};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        auto writer = std::make_shared<BandWriter>(out, h.width, h.height, progress);
+        source->load(writer);
+        writer->finish();
+        if (!out) throw std::runtime_error("cannot write " + tmp.string());
+    }
+    std::filesystem::rename(tmp, target, err);
+    if (err || !openLevel(key, 0)) throw std::runtime_error("cannot map " + target.string());
+}
+
+// next level from the last one, a box filter over 2x2 texels
+void ImageTerrain::downsample(uint64_t key, ThreadPool* pool){
+    const Level& src = mLevels.back();
+    uint32_t level = uint32_t(mLevels.size());
+    int32_t width = (src.width + 1) / 2, height = (src.height + 1) / 2;
+    std::error_code err;
+    std::filesystem::path target = path(key, level);
+    std::filesystem::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot write " + tmp.string());
+        Header h{{'B', 'R', 'Z', 'I'}, VERSION, key, level, width, height, TILE};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        std::vector<float> rows(size_t(width) * TILE);
+        for (int32_t band = 0; band * TILE < height; band++){
+            int32_t valid = std::min(TILE, height - band * TILE);
+            auto filter = [&](size_t begin, size_t end, size_t){
+                for (size_t r = begin; r < end; r++){
+                    int32_t y = 2 * (band * TILE + int32_t(r));
+                    float* row = rows.data() + r * width;
+                    for (int32_t x = 0; x < width; x++)
+                        row[x] = 0.25f * (texel(src, 2 * x, y) + texel(src, 2 * x + 1, y) +
+                                          texel(src, 2 * x, y + 1) + texel(src, 2 * x + 1, y + 1));
+                }
+            };
+            if (pool) pool->parallelFor(0, valid, 16, filter);
+            else filter(0, valid, 0);
+            writeBand(out, rows.data(), width, valid);
+        }
+        if (!out) throw std::runtime_error("cannot write " + tmp.string());
+    }
+    std::filesystem::rename(tmp, target, err);
+    if (err || !openLevel(key, level)) throw std::runtime_error("cannot map " + target.string());
+}
+
+// coordinates outside the level are clamped to it
+float ImageTerrain::texel(const Level& l, int32_t x, int32_t y) const{
+    x = std::clamp(x, 0, l.width - 1);
+    y = std::clamp(y, 0, l.height - 1);
+    size_t tile = size_t(y / TILE) * l.tilesX + x / TILE;
+    return l.texels[tile * TILE * TILE + (y % TILE) * TILE + x % TILE];
+}
+
+float ImageTerrain::sample(vec2 pos, vec2 bounds, float speed) const{
+    if (mLevels.empty()) return 0;
+    // level 0 texels per unit of bounds
+    float scale = std::max(mLevels[0].width / bounds.x, mLevels[0].height / bounds.y);
+    float footprint = std::max(speed * scale, 1.0f);
+    size_t level = std::min(size_t(std::log2(footprint)), mLevels.size() - 1);
+    const Level& l = mLevels[level];
+    return texel(l, int32_t(pos.x / bounds.x * l.width), int32_t(pos.y / bounds.y * l.height));
+}
+
+void ImageTerrain::makePreview(){
+    size_t level = 0;
+    while (level + 1 < mLevels.size() && (mLevels[level].width > DRAW_SIZE || mLevels[level].height > DRAW_SIZE))
+        level++;
+    const Level& l = mLevels[level];
+    mPreview = Channel32f(l.width, l.height);
+    for (int32_t y = 0; y < l.height; y++)
+        for (int32_t x = 0; x < l.width; x++) mPreview.setValue(ivec2(x, y), texel(l, x, y));
+}
+
+const Channel32f& ImageTerrain::preview() const{
+    return mPreview;
+}
+
+size_t ImageTerrain::numLevels() const{
+    return mLevels.size();
+}
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+#include "cinder/audio/Context.h"
+#include "cinder/audio/Node.h"
+#include "cinder/audio/InputNode.h"
+
+#include "Corpus.hpp"
+#include "Oscillator.hpp"
+#include "SlotCommands.hpp"
+#include "Random.hpp"
+
+using namespace cinder;
+using namespace std;
+
+static const size_t MAX_VOICES = 8192;
+
+// One audio node rendering every agent of an engine into a single buffer.
+// Agents own a slot; per-slot parameters are flat arrays of atomics written
+// by the control side and read by the audio thread in one loop.
+// Each slot has its own generator on stream rngStreams + slot.
+class AgentMixer : public audio::InputNode {
+    public:
+        AgentMixer(size_t capacity, uint64_t rngStreams);
+        static const size_t NO_SLOT = size_t(-1);
+        size_t allocate();
+        void release(size_t slot);
+        void setVolume(size_t slot, float v);
+        void setActive(size_t slot, bool active);
+
+    protected:
+        void process(audio::Buffer* buffer) override;
+        virtual void reset(size_t slot) = 0;
+        virtual void mix(float* out, size_t numFrames) = 0;
+        template<typename F>
+        void forActive(F&& fn);
+
+        size_t mCapacity;
+        std::vector<std::atomic<float>> mVolumes;
+        std::vector<std::atomic<bool>> mActive;
+        std::vector<std::atomic<bool>> mFresh;
+        std::vector<Rng> mRngs;// audio thread
+        std::atomic<size_t> mUsed{0};
+        std::vector<size_t> mFree;
+        std::mutex mSlotMutex;
+};
+
+AgentMixer::AgentMixer(size_t capacity, uint64_t rngStreams):
+    audio::InputNode(Format().channels(1)),
+    mCapacity(capacity), mVolumes(capacity), mActive(capacity), mFresh(capacity){
+    mRngs.reserve(capacity);
+    for (size_t i = 0; i < capacity; i++){
+        mVolumes[i] = 0;
+        mActive[i] = false;
+        mFresh[i] = false;
+        mRngs.emplace_back(sessionSeed(), rngStreams + i);
+    }
+}
+
+// control side, NO_SLOT when every slot is taken
+size_t AgentMixer::allocate(){
+    std::lock_guard<std::mutex> lock(mSlotMutex);
+    size_t slot;
+    if (!mFree.empty()){
+        slot = mFree.back();
+        mFree.pop_back();
+    }
+    else if (mUsed < mCapacity) slot = mUsed;
+    else return NO_SLOT;
+    mVolumes[slot] = 0;
+    mFresh[slot].store(true, std::memory_order_release);
+    if (slot == mUsed) mUsed++;
+    return slot;
+}
+
+void AgentMixer::release(size_t slot){
+    if (slot == NO_SLOT) return;
+    setActive(slot, false);
+    std::lock_guard<std::mutex> lock(mSlotMutex);
+    mFree.push_back(slot);
+}
+
+void AgentMixer::setVolume(size_t slot, float v){
+    if (slot != NO_SLOT) mVolumes[slot].store(v, std::memory_order_relaxed);
+}
+
+void AgentMixer::setActive(size_t slot, bool active){
+    if (slot != NO_SLOT) mActive[slot].store(active, std::memory_order_release);
+}
+
+void AgentMixer::process(audio::Buffer* buffer){
+    float* out = buffer->getChannel(0);
+    size_t numFrames = buffer->getNumFrames();
+    std::fill(out, out + numFrames, 0.0f);
+    mix(out, numFrames);
+}
+
+// audio thread, calls fn(slot, volume) for every active slot
+template<typename F>
+void AgentMixer::forActive(F&& fn){
+    size_t used = mUsed.load(std::memory_order_acquire);
+    for (size_t slot = 0; slot < used; slot++){
+        if (!mActive[slot].load(std::memory_order_acquire)) continue;
+        // per-voice state is reset here so only the audio thread touches it
+        if (mFresh[slot].exchange(false, std::memory_order_acq_rel)) reset(slot);
+        fn(slot, mVolumes[slot].load(std::memory_order_relaxed));
+    }
+}
+
+// creates a mixer of type T on the master context and connects it
+template<typename T, typename... Args>
+std::shared_ptr<T> makeMixer(Args&&... args){
+    auto ctx = audio::master();
+    auto mixer = ctx->makeNode(new T(std::forward<Args>(args)...));
+    mixer >> ctx->getOutput();
+    mixer->enable();
+    ctx->enable();
+    return mixer;
+}
+
+// Additive
+
+class AdditiveMixer : public AgentMixer {
+    public:
+        AdditiveMixer(size_t capacity);
+        static AdditiveMixer* get();
+        void setFrequency(size_t slot, float freq);
+
+    protected:
+        void initialize() override;
+        void reset(size_t slot) override;
+        void mix(float* out, size_t numFrames) override;
+        float increment(size_t slot);
+        std::vector<std::atomic<float>> mFrequencies;
+        // phase and per-sample increment of each slot, in cycles
+        std::vector<float> mPhases;
+        std::vector<float> mIncrements;
+        // active slots packed for the oscillator bank
+        std::vector<size_t> mPacked;
+        std::vector<float> mPhaseLanes, mIncrLanes, mTargetLanes, mVolumeLanes;
+        std::vector<float> mAcc;
+        osc::SineBank mBank;
+};
+
+AdditiveMixer::AdditiveMixer(size_t capacity):
+    AgentMixer(capacity, 1ULL << 32), mFrequencies(capacity), mPhases(capacity, 0),
+    mIncrements(capacity, 0), mBank(osc::selectSineBank()){
+    for (auto& f:mFrequencies) f = 440;
+    mPacked.reserve(capacity);
+    size_t lanes = capacity + osc::MAX_LANES;
+    mPhaseLanes.resize(lanes);
+    mIncrLanes.resize(lanes);
+    mTargetLanes.resize(lanes);
+    mVolumeLanes.resize(lanes);
+}
+
+void AdditiveMixer::initialize(){
+    mAcc.resize(getFramesPerBlock() * osc::MAX_LANES);
+}
+
+AdditiveMixer* AdditiveMixer::get(){
+    static std::shared_ptr<AdditiveMixer> mixer = makeMixer<AdditiveMixer>(MAX_VOICES);
+    return mixer.get();
+}
+
+void AdditiveMixer::setFrequency(size_t slot, float freq){
+    if (slot != NO_SLOT) mFrequencies[slot].store(freq, std::memory_order_relaxed);
+}
+
+// clamped below Nyquist so a phase wraps at most once per sample
+float AdditiveMixer::increment(size_t slot){
+    float freq = mFrequencies[slot].load(std::memory_order_relaxed);
+    return std::clamp(freq / (float)getSampleRate(), 0.0f, 0.5f);
+}
+
+// a fresh voice starts at its frequency instead of gliding to it
+void AdditiveMixer::reset(size_t slot){
+    mPhases[slot] = 0.5f * mRngs[slot].uniform();
+    mIncrements[slot] = increment(slot);
+}
+
+// packs the active voices into lanes, runs them through the oscillator
+// bank and stores their phases back
+void AdditiveMixer::mix(float* out, size_t numFrames){
+    mPacked.clear();
+    forActive([this](size_t slot, float volume){
+        if (volume == 0) return;
+        size_t k = mPacked.size();
+        mPacked.push_back(slot);
+        mPhaseLanes[k] = mPhases[slot];
+        mIncrLanes[k] = mIncrements[slot];
+        mTargetLanes[k] = increment(slot);
+        mVolumeLanes[k] = volume;
+    });
+    size_t n = mPacked.size();
+    if (n == 0) return;
+    size_t padded = (n + osc::MAX_LANES - 1) / osc::MAX_LANES * osc::MAX_LANES;
+    for (size_t k = n; k < padded; k++){
+        mPhaseLanes[k] = mIncrLanes[k] = mTargetLanes[k] = mVolumeLanes[k] = 0;
+    }
+    if (mAcc.size() < numFrames * osc::MAX_LANES) mAcc.resize(numFrames * osc::MAX_LANES);
+    mBank(mPhaseLanes.data(), mIncrLanes.data(), mTargetLanes.data(),
+          mVolumeLanes.data(), padded, mAcc.data(), out, numFrames);
+    for (size_t k = 0; k < n; k++){
+        mPhases[mPacked[k]] = mPhaseLanes[k];
+        mIncrements[mPacked[k]] = mIncrLanes[k];
+    }
+}
+
+// Granular
+
+// Control threads send sources to the audio thread through SlotCommands,
+// lock-free rings with one per producer thread; the newest source sent
+// to a slot wins whichever ring it came through.
+// The corpus is swapped through setCorpus; the audio thread adopts it at
+// the start of a block and drops every source and grain of the old one,
+// so the old corpus can be freed once uses() turns false.
+// Voices only decide when to trigger grains; the grains themselves live in
+// one preallocated pool shared by every voice, capped at a maximum count.
+// When more grains are requested than fit, the ones with the least energy
+// left are dropped, so audio cost is bounded by the cap, not the agents.
+class GranularMixer : public AgentMixer {
+    public:
+        GranularMixer(size_t capacity, Corpus* c);
+        static GranularMixer* get(Corpus* c);
+        static GranularMixer* find();
+        bool setSource(size_t slot, const float* data, uint64_t generation);
+        void setCorpus(Corpus* c);
+        bool uses(const Corpus* c) const;
+        void setMaxGrains(size_t n);
+        static const int nOverlap = 8;
+        static const size_t MAX_GRAINS = 4096;
+        static const size_t DEFAULT_MAX_GRAINS = 1024;
+        static const size_t COMMANDS_PER_PRODUCER = 4096;
+
+    protected:
+        struct Grain{
+            const float* data;
+            int offset;
+            int index;
+            int delay;// samples into the block before it starts
+            float gain;
+        };
+        struct SourceCommand{
+            const float* source;
+            uint64_t generation;// of the corpus source belongs to
+        };
+        static std::shared_ptr<GranularMixer>& instance();
+        void adoptCorpus();
+        void reset(size_t slot) override;
+        void mix(float* out, size_t numFrames) override;
+        void trigger(size_t slot, float volume, size_t numFrames);
+        void schedule();
+        float energy(const Grain& g) const;
+        void render(Grain& g, float* out, size_t numFrames);
+        void applyCommands();
+
+        Corpus* mCorpus;// audio thread
+        std::atomic<Corpus*> mPendingCorpus;
+        std::atomic<Corpus*> mAudioCorpus;
+        std::vector<const float*> mSources;
+        std::vector<int> mCountdowns;// samples until a voice's next grain
+        std::vector<Grain> mGrains;
+        std::vector<Grain> mRequests;
+        std::atomic<size_t> mMaxGrains{DEFAULT_MAX_GRAINS};
+        bool mRandomize{true};
+        SlotCommands<SourceCommand> mCommands;
+};
+
+GranularMixer::GranularMixer(size_t capacity, Corpus* c):
+    AgentMixer(capacity, 2ULL << 32), mCorpus(c), mPendingCorpus(c), mAudioCorpus(c),
+    mSources(capacity, nullptr),
+    mCountdowns(capacity, 0),
+    mCommands(capacity, COMMANDS_PER_PRODUCER){
+    mGrains.reserve(MAX_GRAINS + 4 * capacity);
+    mRequests.reserve(4 * capacity);
+}
+
+std::shared_ptr<GranularMixer>& GranularMixer::instance(){
+    static std::shared_ptr<GranularMixer> mixer;
+    return mixer;
+}
+
+// created on first use, with c as its corpus
+GranularMixer* GranularMixer::get(Corpus* c){
+    std::shared_ptr<GranularMixer>& mixer = instance();
+    if (!mixer) mixer = makeMixer<GranularMixer>(MAX_VOICES, c);
+    return mixer.get();
+}
+
+// null until some granular voice was made
+GranularMixer* GranularMixer::find(){
+    return instance().get();
+}
+
+// control side, taken by the audio thread at its next block
+void GranularMixer::setCorpus(Corpus* c){
+    mPendingCorpus.store(c, std::memory_order_release);
+}
+
+// whether the audio thread may still read from c
+bool GranularMixer::uses(const Corpus* c) const{
+    return mAudioCorpus.load(std::memory_order_acquire) == c
+        || mPendingCorpus.load(std::memory_order_acquire) == c;
+}
+
+void GranularMixer::adoptCorpus(){
+    Corpus* c = mPendingCorpus.load(std::memory_order_acquire);
+    if (c == mCorpus) return;
+    mCorpus = c;
+    std::fill(mSources.begin(), mSources.end(), nullptr);
+    mGrains.clear();
+    mAudioCorpus.store(c, std::memory_order_release);
+}
+
+void GranularMixer::setMaxGrains(size_t n){
+    mMaxGrains.store(std::min(n, MAX_GRAINS), std::memory_order_relaxed);
+}
+
+// any control thread, false if the command could not be queued
+bool GranularMixer::setSource(size_t slot, const float* data, uint64_t generation){
+    if (slot == NO_SLOT) return true;
+    return mCommands.push(slot, {data, generation});
+}
+
+// audio thread, stale commands for a slot are already skipped. Sources
+// from an older corpus are dropped; one from a newer corpus means it was
+// set before the command was sent, so it is adopted first.
+void GranularMixer::applyCommands(){
+    adoptCorpus();
+    mCommands.drain([this](size_t slot, const SourceCommand& cmd){
+        if (cmd.generation > mCorpus->mGeneration) adoptCorpus();
+        if (cmd.generation == mCorpus->mGeneration) mSources[slot] = cmd.source;
+    });
+}
+
+// a fresh voice starts with a grain
+void GranularMixer::reset(size_t slot){
+    mCountdowns[slot] = 0;
+}
+
+void GranularMixer::mix(float* out, size_t numFrames){
+    applyCommands();
+    if (mCorpus->ENV_SIZE == 0) return;
+    mRequests.clear();
+    forActive([&](size_t slot, float volume){
+        trigger(slot, volume, numFrames);
+    });
+    schedule();
+    for (auto& g:mGrains) render(g, out, numFrames);
+    // drop finished grains
+    size_t live = 0;
+    for (auto& g:mGrains){
+        if (g.index < mCorpus->ENV_SIZE) mGrains[live++] = g;
+    }
+    mGrains.resize(live);
+}
+
+// requests the grains a voice starts during this block. Silent voices
+// keep their timing but request nothing.
+void GranularMixer::trigger(size_t slot, float volume, size_t numFrames){
+    int period = mCorpus->ENV_SIZE / nOverlap + 1;
+    int pos = mCountdowns[slot];
+    const float* source = mSources[slot];
+    for (; pos < int(numFrames); pos += period){
+        if (volume == 0 || source == nullptr) continue;
+        if (mRequests.size() == mRequests.capacity()) continue;
+        int offset = 0;
+        if(mRandomize) offset = int(
+                (mCorpus->GRAIN_SIZE - mCorpus->ENV_SIZE) * mRngs[slot].uniform()
+        );
+        mRequests.push_back({source, offset, 0, pos, volume});
+    }
+    mCountdowns[slot] = pos - int(numFrames);
+}
+
+// what a grain has left to play: its gain times the part of the
+// envelope it has not played yet, so quiet and old grains go first
+float GranularMixer::energy(const Grain& g) const{
+    return g.gain * float(mCorpus->ENV_SIZE - g.index);
+}
+
+// admits the requests into the pool, stealing grains when it is full
+void GranularMixer::schedule(){
+    size_t maxGrains = mMaxGrains.load(std::memory_order_relaxed);
+    mGrains.insert(mGrains.end(), mRequests.begin(), mRequests.end());
+    if (mGrains.size() > maxGrains){
+        std::nth_element(mGrains.begin(), mGrains.begin() + maxGrains, mGrains.end(),
+            [this](const Grain& a, const Grain& b){return energy(a) > energy(b);});
+        mGrains.resize(maxGrains);
+    }
+}
+
+void GranularMixer::render(Grain& g, float* out, size_t numFrames){
+    const float* env = mCorpus->envelope.getData();
+    int n = std::min(int(numFrames) - g.delay, mCorpus->ENV_SIZE - g.index);
+    const float* data = g.data + g.offset + g.index;
+    env += g.index;
+    out += g.delay;
+    for (int i = 0; i < n; i++) out[i] += g.gain * env[i] * data[i];
+    g.index += n;
+    g.delay = 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include "cinder/Vector.h"
+#include "Simd.hpp"
+
+using namespace cinder;
+
+// Distance test for flock rules: takes candidate agent indices into an
+// interleaved xy position array and writes out the ones that lie within
+// (0, threshold) of (px, py), using the shortest displacement on a
+// w x h torus. Output keeps the candidate order.
+namespace kernel{
+
+struct Neighbor{
+    int index;
+    vec2 diff;
+    float dist;
+};
+
+using NeighborKernel = size_t (*)(const float* xy, const int* idx, size_t n,
+                                  float px, float py, float threshold,
+                                  float w, float h, Neighbor* out);
+
+size_t neighborsScalar(const float* xy, const int* idx, size_t n,
+                       float px, float py, float threshold,
+                       float w, float h, Neighbor* out){
+    size_t count = 0;
+    for (size_t k = 0; k < n; k++){
+        int j = idx[k];
+        float dx = xy[2 * j] - px;
+        float dy = xy[2 * j + 1] - py;
+        dx -= w * std::round(dx / w);
+        dy -= h * std::round(dy / h);
+        float dist = std::sqrt(dx * dx + dy * dy);
+        if (dist > 0 && dist < threshold) out[count++] = {j, vec2(dx, dy), dist};
+    }
+    return count;
+}
+
+#ifdef BRUNZIT_SIMD_X86
+
+// SSE2 is part of x86-64, so this path needs no dispatch
+size_t neighborsSSE(const float* xy, const int* idx, size_t n,
+                    float px, float py, float threshold,
+                    float w, float h, Neighbor* out){
+    const __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+    const __m128 vw = _mm_set1_ps(w), vh = _mm_set1_ps(h);
+    const __m128 vinvw = _mm_set1_ps(1.0f / w), vinvh = _mm_set1_ps(1.0f / h);
+    const __m128 vthr = _mm_set1_ps(threshold), vzero = _mm_setzero_ps();
+    alignas(16) float dxs[4], dys[4], dists[4];
+    size_t count = 0;
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4){
+        const int* j = idx + k;
+        __m128 dx = _mm_sub_ps(_mm_set_ps(xy[2 * j[3]], xy[2 * j[2]],
+                                          xy[2 * j[1]], xy[2 * j[0]]), vpx);
+        __m128 dy = _mm_sub_ps(_mm_set_ps(xy[2 * j[3] + 1], xy[2 * j[2] + 1],
+                                          xy[2 * j[1] + 1], xy[2 * j[0] + 1]), vpy);
+        dx = _mm_sub_ps(dx, _mm_mul_ps(vw, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dx, vinvw)))));
+        dy = _mm_sub_ps(dy, _mm_mul_ps(vh, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dy, vinvh)))));
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(dist, vzero),
+                                              _mm_cmplt_ps(dist, vthr)));
+        if (mask == 0) continue;
+        _mm_store_ps(dxs, dx);
+        _mm_store_ps(dys, dy);
+        _mm_store_ps(dists, dist);
+        for (int l = 0; l < 4; l++)
+            if (mask & (1 << l)) out[count++] = {j[l], vec2(dxs[l], dys[l]), dists[l]};
+    }
+    return count + neighborsScalar(xy, idx + k, n - k, px, py, threshold, w, h, out + count);
+}
+
+#endif
+
+#ifdef BRUNZIT_AVX2
+
+BRUNZIT_TARGET_AVX2
+size_t neighborsAVX2(const float* xy, const int* idx, size_t n,
+                     float px, float py, float threshold,
+                     float w, float h, Neighbor* out){
+    const __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+    const __m256 vw = _mm256_set1_ps(w), vh = _mm256_set1_ps(h);
+    const __m256 vinvw = _mm256_set1_ps(1.0f / w), vinvh = _mm256_set1_ps(1.0f / h);
+    const __m256 vthr = _mm256_set1_ps(threshold), vzero = _mm256_setzero_ps();
+    const int round = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+    alignas(32) float dxs[8], dys[8], dists[8];
+    size_t count = 0;
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8){
+        // positions are interleaved, so x and y are gathered at 2*j and 2*j+1
+        __m256i j = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + k));
+        __m256i jx = _mm256_add_epi32(j, j);
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(xy, jx, 4), vpx);
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(xy + 1, jx, 4), vpy);
+        dx = _mm256_sub_ps(dx, _mm256_mul_ps(vw, _mm256_round_ps(_mm256_mul_ps(dx, vinvw), round)));
+        dy = _mm256_sub_ps(dy, _mm256_mul_ps(vh, _mm256_round_ps(_mm256_mul_ps(dy, vinvh), round)));
+        __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        int mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(dist, vzero, _CMP_GT_OQ),
+                                                    _mm256_cmp_ps(dist, vthr, _CMP_LT_OQ)));
+        if (mask == 0) continue;
+        _mm256_store_ps(dxs, dx);
+        _mm256_store_ps(dys, dy);
+        _mm256_store_ps(dists, dist);
+        for (int l = 0; l < 8; l++)
+            if (mask & (1 << l)) out[count++] = {idx[k + l], vec2(dxs[l], dys[l]), dists[l]};
+    }
+    return count + neighborsScalar(xy, idx + k, n - k, px, py, threshold, w, h, out + count);
+}
+
+#endif
+
+// picked once at startup from what the CPU supports
+NeighborKernel selectNeighborKernel(){
+#ifdef BRUNZIT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return neighborsAVX2;
+#endif
+#ifdef BRUNZIT_SIMD_X86
+    return neighborsSSE;
+#else
+    return neighborsScalar;
+#endif
+}
+
+}
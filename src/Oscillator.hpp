@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include "Simd.hpp"
+
+// Sine oscillator bank for the additive engine: runs many voices at once,
+// one per SIMD lane. Phases are normalized to [0, 1) and advance by incr
+// per sample; incr glides linearly to target over the block so frequency
+// changes don't click. Voices are summed into out.
+namespace osc{
+
+// callers pad the voice arrays to a multiple of this, with zero volume
+static const size_t MAX_LANES = 8;
+
+// acc is scratch of numFrames * MAX_LANES floats
+using SineBank = void (*)(float* phase, float* incr, const float* target,
+                          const float* volume, size_t n,
+                          float* acc, float* out, size_t numFrames);
+
+// parabolic sine with one refinement step, error at most about 0.0011
+inline float sine(float phase){
+    float x = 2 * phase - 1;
+    float y = 4 * x * (1 - std::fabs(x));
+    y += 0.225f * (y * std::fabs(y) - y);
+    return -y;
+}
+
+// sums straight into out, acc is only there for the common signature
+void sineBankScalar(float* phase, float* incr, const float* target,
+                    const float* volume, size_t n,
+                    [[maybe_unused]] float* acc, float* out, size_t numFrames){
+    for (size_t k = 0; k < n; k++){
+        if (volume[k] == 0) continue;
+        float p = phase[k], inc = incr[k];
+        float step = (target[k] - inc) / numFrames;
+        for (size_t i = 0; i < numFrames; i++){
+            inc += step;
+            p += inc;
+            if (p >= 1) p -= 1;
+            out[i] += volume[k] * sine(p);
+        }
+        phase[k] = p;
+        incr[k] = target[k];
+    }
+}
+
+#ifdef BRUNZIT_SIMD_X86
+
+inline __m128 sineSSE(__m128 phase){
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 x = _mm_sub_ps(_mm_add_ps(phase, phase), _mm_set1_ps(1));
+    __m128 y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4), x),
+                          _mm_sub_ps(_mm_set1_ps(1), _mm_andnot_ps(sign, x)));
+    __m128 r = _mm_sub_ps(_mm_mul_ps(y, _mm_andnot_ps(sign, y)), y);
+    y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(0.225f), r));
+    return _mm_xor_ps(y, sign);
+}
+
+void sineBankSSE(float* phase, float* incr, const float* target,
+                 const float* volume, size_t n,
+                 float* acc, float* out, size_t numFrames){
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 invFrames = _mm_set1_ps(1.0f / numFrames);
+    for (size_t i = 0; i < numFrames * 4; i++) acc[i] = 0;
+    for (size_t k = 0; k + 4 <= n; k += 4){
+        __m128 p = _mm_loadu_ps(phase + k);
+        __m128 inc = _mm_loadu_ps(incr + k);
+        __m128 tgt = _mm_loadu_ps(target + k);
+        __m128 vol = _mm_loadu_ps(volume + k);
+        __m128 step = _mm_mul_ps(_mm_sub_ps(tgt, inc), invFrames);
+        for (size_t i = 0; i < numFrames; i++){
+            inc = _mm_add_ps(inc, step);
+            p = _mm_add_ps(p, inc);
+            p = _mm_sub_ps(p, _mm_and_ps(_mm_cmpge_ps(p, one), one));
+            __m128 a = _mm_loadu_ps(acc + 4 * i);
+            _mm_storeu_ps(acc + 4 * i, _mm_add_ps(a, _mm_mul_ps(vol, sineSSE(p))));
+        }
+        _mm_storeu_ps(phase + k, p);
+        _mm_storeu_ps(incr + k, tgt);
+    }
+    for (size_t i = 0; i < numFrames; i++)
+        out[i] += acc[4 * i] + acc[4 * i + 1] + acc[4 * i + 2] + acc[4 * i + 3];
+}
+
+#endif
+
+#ifdef BRUNZIT_AVX2
+
+BRUNZIT_TARGET_AVX2
+inline __m256 sineAVX2(__m256 phase){
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 x = _mm256_sub_ps(_mm256_add_ps(phase, phase), _mm256_set1_ps(1));
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4), x),
+                             _mm256_sub_ps(_mm256_set1_ps(1), _mm256_andnot_ps(sign, x)));
+    __m256 r = _mm256_sub_ps(_mm256_mul_ps(y, _mm256_andnot_ps(sign, y)), y);
+    y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(0.225f), r));
+    return _mm256_xor_ps(y, sign);
+}
+
+BRUNZIT_TARGET_AVX2
+void sineBankAVX2(float* phase, float* incr, const float* target,
+                  const float* volume, size_t n,
+                  float* acc, float* out, size_t numFrames){
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 invFrames = _mm256_set1_ps(1.0f / numFrames);
+    for (size_t i = 0; i < numFrames * 8; i++) acc[i] = 0;
+    for (size_t k = 0; k + 8 <= n; k += 8){
+        __m256 p = _mm256_loadu_ps(phase + k);
+        __m256 inc = _mm256_loadu_ps(incr + k);
+        __m256 tgt = _mm256_loadu_ps(target + k);
+        __m256 vol = _mm256_loadu_ps(volume + k);
+        __m256 step = _mm256_mul_ps(_mm256_sub_ps(tgt, inc), invFrames);
+        for (size_t i = 0; i < numFrames; i++){
+            inc = _mm256_add_ps(inc, step);
+            p = _mm256_add_ps(p, inc);
+            p = _mm256_sub_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, one, _CMP_GE_OQ), one));
+            __m256 a = _mm256_loadu_ps(acc + 8 * i);
+            _mm256_storeu_ps(acc + 8 * i, _mm256_add_ps(a, _mm256_mul_ps(vol, sineAVX2(p))));
+        }
+        _mm256_storeu_ps(phase + k, p);
+        _mm256_storeu_ps(incr + k, tgt);
+    }
+    // fold the lanes of each sample once, after every voice is in
+    for (size_t i = 0; i < numFrames; i++){
+        __m128 a = _mm_add_ps(_mm_loadu_ps(acc + 8 * i), _mm_loadu_ps(acc + 8 * i + 4));
+        a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+        out[i] += _mm_cvtss_f32(a);
+    }
+}
+
+#endif
+
+// picked once at startup from what the CPU supports
+SineBank selectSineBank(){
+#ifdef BRUNZIT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return sineBankAVX2;
+#endif
+#ifdef BRUNZIT_SIMD_X86
+    return sineBankSSE;
+#else
+    return sineBankScalar;
+#endif
+}
+
+}
@@ -37,14 +37,17 @@ class Parser{
         ActionRef parseWander(list<string> params, bool& err);
         ActionRef parseStop(list<string> params, bool& err);
         ActionRef parseSeek(list<string> params, bool& err);
+        ActionRef parseTimbre(list<string> params, bool& err);
         ActionRef parseDie(list<string> params, bool& err);
         ActionRef parseVolume(list<string> params, bool& err);
         ActionRef parseAvoid(list<string> params, bool& err);
         ActionRef parseJoin(list<string> params, bool& err);
         ActionRef parseAlign(list<string> params, bool& err);
         ActionRef parseMap(list<string> params, bool& err);
+        ActionRef parseAdd(list<string> params, bool& err);
         ActionRef parseMake(list<string> params, bool& err);
         ActionRef parseBackground(list<string> params, bool& err);
+        ActionRef parseGrains(list<string> params, bool& err);
 
 private:
     Runtime& mRuntime;
@@ -126,8 +129,11 @@ ActionRef Parser::parseAction(const string& code, bool& err){
         else if(action == "stop") result =  parseStop(words, err);
         else if(action == "make") result =  parseMake(words, err);
         else if(action == "map") result =  parseMap(words, err);
+        else if(action == "add") result =  parseAdd(words, err);
         else if(action == "background") result =  parseBackground(words, err);
+        else if(action == "grains") result =  parseGrains(words, err);
         else if(action == "seek") result =  parseSeek(words, err);
+        else if(action == "timbre") result =  parseTimbre(words, err);
         else if(action == "volume") result =  parseVolume(words, err);
         else if(action == "die") result =  parseDie(words, err);
         else if(action == "avoid") result =  parseAvoid(words, err);
@@ -227,6 +233,20 @@ ActionRef Parser::parseSeek(list<string> params, bool& err){
     return ActionRef(std::make_shared<actions::seek>(action));
 }
 
+ActionRef Parser::parseTimbre(list<string> params, bool& err){
+    using namespace std;
+    actions::timbre action;
+    checkNumParams(params, 2, 3, err);
+    if (!params.empty()) {
+        if (params.front() == "cluster") action.cluster = true;
+        else if (params.front() != "segment") err = true;
+        params.pop_front();
+    }
+    if (!params.empty()) {action.target = stoi(params.front()); params.pop_front();}
+    if (!params.empty()) {action.freq = parseFreq(params.front(), err); params.pop_front();}
+    return ActionRef(std::make_shared<actions::timbre>(action));
+}
+
 
 ActionRef Parser::parseVolume(list<string> params, bool& err){
     using namespace std;
@@ -309,10 +329,36 @@ ActionRef Parser::parseMake(list<string> params, bool& err){
     return ActionRef(std::make_shared<actions::make>(action));
 }
 
+ActionRef Parser::parseGrains(list<string> params, bool& err){
+    using namespace std;
+    actions::grains action;
+    checkNumParams(params, 1, 1, err);
+    if (!params.empty()) {action.max = stoi(params.front()); params.pop_front();}
+    if (action.max < 0) err = true;
+    return ActionRef(std::make_shared<actions::grains>(action));
+}
+
 ActionRef Parser::parseMap(list<string> params, bool& err){
     using namespace std;
     actions::map action;
-    checkNumParams(params, 1, 1, err);
+    checkNumParams(params, 1, 6, err);
     if (!params.empty()) {action.file = params.front(); params.pop_front();}
+    for (auto& name:params){
+        if (name == "mapped"){
+            action.mapped = true;
+            continue;
+        }
+        uint32_t flag = extractor::descriptor(name);
+        if (flag == 0) err = true;
+        action.descriptors |= flag;
+    }
     return ActionRef(std::make_shared<actions::map>(action));
 }
+
+ActionRef Parser::parseAdd(list<string> params, bool& err){
+    using namespace std;
+    actions::add action;
+    checkNumParams(params, 1, 1, err);
+    if (!params.empty()) {action.file = params.front(); params.pop_front();}
+    return ActionRef(std::make_shared<actions::add>(action));
+}
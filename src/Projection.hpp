@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <data/FluidDataSet.hpp>
+#include <data/TensorTypes.hpp>
+#include <algorithms/public/UMAP.hpp>
+#include <algorithms/public/Grid.hpp>
+
+#include "ThreadPool.hpp"
+
+using namespace fluid;
+
+// 2d layout of descriptor rows: a UMAP embedding, and a grid cell for
+// every embedded point. Keeps the trained model, so later rows can be
+// placed against it.
+class Projection{
+    public:
+        using DataSet = FluidDataSet<std::string, double, 1>;
+        void setPool(ThreadPool* pool);
+        RealMatrix embed(const RealMatrix& data);
+        // rows placed with the model of the last embed
+        RealMatrix transform(const DataSet& data);
+        bool trained() const;
+        RealMatrix gridPositions(const RealMatrix& projection);
+        static DataSet toDataSet(const RealMatrix& points);
+        // above this many rows UMAP trains on a sample of UMAP_SAMPLES
+        // and the grid is assigned in tiles of about GRID_TILE points
+        static constexpr index LARGE_CORPUS = 20000;
+        static constexpr index UMAP_SAMPLES = 10000;
+        static constexpr index GRID_TILE = 4096;
+
+    private:
+        algorithm::UMAP mUmap;
+        algorithm::Grid mGrid;
+        ThreadPool* mPool{nullptr};
+};
+
+void Projection::setPool(ThreadPool* pool){
+    mPool = pool;
+}
+
+RealMatrix Projection::transform(const DataSet& data){
+    return RealMatrix(mUmap.transform(data).getData());
+}
+
+bool Projection::trained() const{
+    return mUmap.initialized();
+}
+
+// rows named by index, as segments are
+Projection::DataSet Projection::toDataSet(const RealMatrix& points){
+    DataSet ds(points.cols());
+    RealVector point(points.cols());
+    for (index i = 0; i < points.rows(); i++){
+        point <<= points.row(i);
+        ds.add(std::to_string(i), point);
+    }
+    return ds;
+}
+
+// UMAP embedding of the rows of data. A large corpus trains on evenly
+// spaced rows and places the others with transform, in parallel chunks
+// against the trained model, so the neighbor graph stays the size of
+// the sample. FluCoMa does not say transform is safe to call at once on
+// one model, so every pool slot places its chunks with its own copy.
+RealMatrix Projection::embed(const RealMatrix& data){
+    index n = data.rows();
+    if (n <= LARGE_CORPUS) return RealMatrix(mUmap.train(toDataSet(data)).getData());
+    index stride = (n + UMAP_SAMPLES - 1) / UMAP_SAMPLES;
+    DataSet sample(data.cols());
+    RealVector point(data.cols());
+    std::vector<index> rest;
+    for (index i = 0; i < n; i++){
+        if (i % stride != 0){
+            rest.push_back(i);
+            continue;
+        }
+        point <<= data.row(i);
+        sample.add(std::to_string(i), point);
+    }
+    RealMatrix out(n, 2);
+    auto trainedDS = mUmap.train(sample);
+    auto trained = trainedDS.getData();
+    for (index k = 0; k < trained.rows(); k++){
+        out(k * stride, 0) = trained(k, 0);
+        out(k * stride, 1) = trained(k, 1);
+    }
+    std::vector<algorithm::UMAP> models(mPool ? mPool->size() : 1, mUmap);
+    auto transform = [&](size_t begin, size_t end, size_t slot){
+        DataSet chunk(data.cols());
+        RealVector row(data.cols());
+        for (size_t k = begin; k < end; k++){
+            row <<= data.row(rest[k]);
+            chunk.add(std::to_string(rest[k]), row);
+        }
+        auto placedDS = models[slot].transform(chunk);
+        auto placed = placedDS.getData();
+        for (size_t k = begin; k < end; k++){
+            out(rest[k], 0) = placed(k - begin, 0);
+            out(rest[k], 1) = placed(k - begin, 1);
+        }
+    };
+    if (mPool) mPool->parallelFor(0, rest.size(), 1024, transform);
+    else transform(0, rest.size(), 0);
+    return out;
+}
+
+// Grid cell for every projected point. A large corpus is cut into
+// equal count bands along x and equal count tiles along y within each
+// band; tiles are assigned in parallel and packed side by side, bands
+// left to right and tiles top to bottom.
+RealMatrix Projection::gridPositions(const RealMatrix& projection){
+    index n = projection.rows();
+    if (n <= LARGE_CORPUS) return RealMatrix(mGrid.process(toDataSet(projection)).getData());
+    index side = index(std::ceil(std::sqrt(double(n) / GRID_TILE)));
+    std::vector<index> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    auto byAxis = [&](int d){
+        return [&projection, d](index a, index b){return projection(a, d) < projection(b, d);};
+    };
+    std::sort(order.begin(), order.end(), byAxis(0));
+    struct Tile{
+        index begin, end, band;
+        RealMatrix cells;
+    };
+    std::vector<Tile> tiles;
+    index bandSize = (n + side - 1) / side;
+    for (index b = 0; b * bandSize < n; b++){
+        index begin = b * bandSize, end = std::min(n, begin + bandSize);
+        std::sort(order.begin() + begin, order.begin() + end, byAxis(1));
+        index tileSize = (end - begin + side - 1) / side;
+        for (index t = begin; t < end; t += tileSize)
+            tiles.push_back({t, std::min(end, t + tileSize), b, RealMatrix()});
+    }
+    auto assign = [&](size_t begin, size_t end, size_t){
+        for (size_t k = begin; k < end; k++){
+            Tile& tile = tiles[k];
+            RealMatrix points(tile.end - tile.begin, 2);
+            for (index i = tile.begin; i < tile.end; i++){
+                points(i - tile.begin, 0) = projection(order[i], 0);
+                points(i - tile.begin, 1) = projection(order[i], 1);
+            }
+            algorithm::Grid grid;
+            tile.cells = RealMatrix(grid.process(toDataSet(points)).getData());
+        }
+    };
+    if (mPool) mPool->parallelFor(0, tiles.size(), 1, assign);
+    else assign(0, tiles.size(), 0);
+    RealMatrix out(n, 2);
+    index x = 0, y = 0, width = 0, band = 0;
+    for (auto& tile:tiles){
+        if (tile.band != band){
+            x += width;
+            y = 0;
+            width = 0;
+            band = tile.band;
+        }
+        index height = 0;
+        for (index i = 0; i < tile.cells.rows(); i++){
+            out(order[tile.begin + i], 0) = x + tile.cells(i, 0);
+            out(order[tile.begin + i], 1) = y + tile.cells(i, 1);
+            width = std::max(width, index(tile.cells(i, 0)) + 1);
+            height = std::max(height, index(tile.cells(i, 1)) + 1);
+        }
+        y += height;
+    }
+    return out;
+}
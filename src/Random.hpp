@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Small xoshiro128+ generator. Each flock and each voice owns one, so
+// nothing shares hidden state across threads and the audio thread never
+// takes a lock. All of them derive from one session seed, so a session
+// replays the same way when started with the same seed.
+class Rng{
+    public:
+        Rng(uint64_t seed = 0, uint64_t stream = 0);
+        uint32_t next();
+        float uniform();// [0, 1)
+        float uniform(float lo, float hi);
+
+    private:
+        uint32_t mState[4];
+};
+
+std::atomic<uint64_t>& sessionSeedRef(){
+    static std::atomic<uint64_t> seed{0};
+    return seed;
+}
+
+uint64_t sessionSeed(){
+    return sessionSeedRef().load(std::memory_order_relaxed);
+}
+
+void setSessionSeed(uint64_t seed){
+    sessionSeedRef().store(seed, std::memory_order_relaxed);
+}
+
+namespace {
+    uint64_t splitmix64(uint64_t& x){
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+}
+
+// streams with the same seed are independent of each other
+Rng::Rng(uint64_t seed, uint64_t stream){
+    uint64_t x = seed ^ splitmix64(stream);
+    uint64_t a = splitmix64(x), b = splitmix64(x);
+    mState[0] = uint32_t(a);
+    mState[1] = uint32_t(a >> 32);
+    mState[2] = uint32_t(b);
+    mState[3] = uint32_t(b >> 32);
+}
+
+uint32_t Rng::next(){
+    uint32_t result = mState[0] + mState[3];
+    uint32_t t = mState[1] << 9;
+    mState[2] ^= mState[0];
+    mState[3] ^= mState[1];
+    mState[1] ^= mState[2];
+    mState[0] ^= mState[3];
+    mState[2] ^= t;
+    mState[3] = (mState[3] << 11) | (mState[3] >> 21);
+    return result;
+}
+
+// top 24 bits, the low bits of xoshiro128+ are weak
+float Rng::uniform(){
+    return (next() >> 8) * (1.0f / 16777216.0f);
+}
+
+float Rng::uniform(float lo, float hi){
+    return lo + (hi - lo) * uniform();
+}
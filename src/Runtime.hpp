@@ -5,8 +5,16 @@
 #include "cinder/gl/gl.h"
 #include "Actions.hpp"
 #include "Flock.hpp"
+#include "ThreadPool.hpp"
+#include "WorldIndex.hpp"
+#include "SpscQueue.hpp"
+#include "TripleBuffer.hpp"
+#include "Frame.hpp"
+#include "TerrainLoader.hpp"
 #include  <map>
 #include <filesystem>
+#include <thread>
+#include <atomic>
 
 using std::string;
 using cinder::Color;
@@ -14,6 +22,9 @@ using namespace actions;
 
 using ActionRef = shared_ptr<Action>;
 
+static const float SIM_RATE = 120;// simulation ticks per second
+static const float FRAME_RATE = 30;// rate behaviours were designed for
+
 struct Behaviour{
     string flockName;
     vector<ActionRef> actions;
@@ -21,6 +32,10 @@ struct Behaviour{
 
 class Runtime{
     public:
+        ~Runtime();
+        void start(float tickRate = SIM_RATE);
+        void stop();
+        void setTickRate(float tickRate);
         std::vector<string>& getFlockNames();
         bool hasFlock(std::string name);
         bool addBehaviour(Behaviour b);
@@ -28,13 +43,60 @@ class Runtime{
         void runFlockActions(Behaviour& b);
         bool addFlock(ActionRef a);
         bool makeMap(ActionRef a);
+        bool addToMap(ActionRef a);
         bool changeBackground(ActionRef a);
+        bool setMaxGrains(ActionRef a);
         void update();
         void draw();
+        bool isLoading() const;
+        float loadProgress() const;
+        string loadingFile() const;
+        const char* loadingTask() const;
+        const std::string& loadError() const;
         Color bgColor{0,0,0};
-        Corpus mCorpus;
+        std::shared_ptr<Corpus> mCorpus{std::make_shared<Corpus>()};
+        bool useSpatialGrid{true};// false: brute force neighbor search
     private:
+        void simulate();
+        vec2 simBounds() const;
+        void pause();
+        void resume();
+        void applyCommands();
+        void adoptTerrain();
+        void applyTerrain(LoadedTerrain& loaded);
+        void swapCorpus(std::shared_ptr<Corpus> next);
+        void freeRetired();
+        void beginFrame(WorldFrame& frame);
+        void endFrame(WorldFrame& frame, vec2 bounds);
+        float neighborRadius(const Behaviour& b);
+        void buildWorldIndex(vec2 bounds);
+        bool neighborRule(const ActionRef& a, const string& self,
+                          NeighborRules::Rule& rule, string& target);
+        bool resolveTarget(const string& target, const string& self,
+                           const NeighborSource*& source);
+        size_t runNeighborActions(Flock& f, const string& self,
+                                  vector<ActionRef>::iterator begin,
+                                  vector<ActionRef>::iterator end);
+        ThreadPool mPool;
+        VoicePool mVoices;
+        TerrainLoader mLoader;
+        // replaced terrains, freed once the audio thread stopped reading them
+        std::vector<std::shared_ptr<Corpus>> mRetired;
+        // grains cap, kept for a granular mixer made by a later terrain
+        size_t mMaxGrains{GranularMixer::DEFAULT_MAX_GRAINS};
+        WorldIndex mWorld;
+        std::vector<std::pair<string, FlockSnapshot*>> mTargets;
+        SpscQueue<Behaviour> mCommands;
+        TripleBuffer<WorldFrame> mFrames;
+        std::thread mSimThread;
+        std::atomic<bool> mRunning{false};
+        std::atomic<bool> mPauseRequested{false};
+        std::atomic<bool> mPaused{false};
+        std::atomic<float> mTickRate{SIM_RATE};
+        std::atomic<int> mWidth{1};
+        std::atomic<int> mHeight{1};
         std::vector<string> mFlockNames;
+        std::vector<string> mActiveFlocks;
         std::unordered_map<string, Flock> mFlocks;
         std::unordered_map<string, Behaviour> mBehaviours;
         std::unordered_map<string, string> mIcons{
@@ -49,19 +111,240 @@ class Runtime{
 
 std::vector<string>& Runtime::getFlockNames(){return mFlockNames;};
 
+Runtime::~Runtime(){
+    stop();
+}
+
+// Runs update() on its own thread at a fixed tick rate,
+// independent of the render loop.
+void Runtime::start(float tickRate){
+    if (mRunning) return;
+    mWidth = app::getWindowWidth();
+    mHeight = app::getWindowHeight();
+    setTickRate(tickRate);
+    mRunning = true;
+    mSimThread = std::thread([this]{simulate();});
+}
+
+void Runtime::stop(){
+    mRunning = false;
+    if (mSimThread.joinable()) mSimThread.join();
+}
+
+void Runtime::setTickRate(float tickRate){
+    mTickRate = std::max(tickRate, 1.0f);
+}
+
+void Runtime::simulate(){
+    using clock = std::chrono::steady_clock;
+    auto next = clock::now();
+    while (mRunning){
+        if (mPauseRequested){
+            mPaused = true;
+            while (mPauseRequested && mRunning)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            mPaused = false;
+            next = clock::now();
+            continue;
+        }
+        update();
+        auto period = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(1.0 / mTickRate)
+        );
+        next += period;
+        // after a long stall, drop ticks instead of catching up in a burst
+        if (clock::now() - next > period * 4) next = clock::now();
+        std::this_thread::sleep_until(next);
+    }
+}
+
+// window size the render thread last saw; glm can't take the atomics as is
+vec2 Runtime::simBounds() const{
+    return vec2(float(mWidth.load()), float(mHeight.load()));
+}
+
+// Stops the simulation thread between ticks, used to change flocks and
+// terrain from the UI thread. No-op when the thread is not running.
+void Runtime::pause(){
+    if (!mSimThread.joinable()) return;
+    mPauseRequested = true;
+    while (!mPaused && mRunning) std::this_thread::yield();
+}
+
+void Runtime::resume(){
+    mPauseRequested = false;
+    while (mPaused) std::this_thread::yield();
+}
+
+void Runtime::applyCommands(){
+    Behaviour b;
+    while (mCommands.pop(b)) mBehaviours[b.flockName] = std::move(b);
+}
+
 
+// Flocks run as parallel tasks on the pool, and each flock splits its
+// neighbor rules in agent ranges on the same pool.
 void Runtime::update(){
-    for(auto f:mFlockNames){
-        if (mBehaviours.find(f) != mBehaviours.end()) {
-            runFlockActions(mBehaviours.at(f));
+    vec2 bounds = simBounds();
+    float timeScale = FRAME_RATE / mTickRate;
+    WorldFrame& frame = mFrames.back();
+    applyCommands();
+    for (auto& f:mFlocks) f.second.compact();
+    beginFrame(frame);
+    mActiveFlocks.clear();
+    for(auto& f:mFlockNames){
+        if (mBehaviours.find(f) != mBehaviours.end()) mActiveFlocks.push_back(f);
+    }
+    buildWorldIndex(bounds);
+    mPool.parallelFor(0, mActiveFlocks.size(), 1, [&](size_t begin, size_t end, size_t){
+        for (size_t k = begin; k < end; k++){
+            Flock& f = mFlocks.at(mActiveFlocks[k]);
+            Behaviour& b = mBehaviours.at(mActiveFlocks[k]);
+            f.setBounds(bounds);
+            f.setTimeScale(timeScale);
+            float radius = neighborRadius(b);
+            if (radius > 0) f.index(radius, useSpatialGrid);
+            runFlockActions(b);
         }
+    });
+    endFrame(frame, bounds);
+    mFrames.publish();
+}
+
+void Runtime::beginFrame(WorldFrame& frame){
+    frame.flocks.resize(mFlockNames.size());
+    for (size_t k = 0; k < mFlockNames.size(); k++)
+        frame.flocks[k].previous = mFlocks.at(mFlockNames[k]).store().positions;
+}
+
+void Runtime::endFrame(WorldFrame& frame, vec2 bounds){
+    for (size_t k = 0; k < mFlockNames.size(); k++){
+        const AgentStore& agents = mFlocks.at(mFlockNames[k]).store();
+        FlockFrame& f = frame.flocks[k];
+        f.icon = agents.icon;
+        f.color = agents.color;
+        f.current = agents.positions;
+        f.headings = agents.headings;
+        f.alive = agents.alive;
     }
+    frame.bounds = bounds;
+    frame.tick = 1.0 / mTickRate;
+    frame.time = frameClock();
 }
 
+// Snapshots every flock that another flock targets, once per tick,
+// with the largest threshold used against it as cell size.
+void Runtime::buildWorldIndex(vec2 bounds){
+    mWorld.clear();
+    mTargets.clear();
+    NeighborRules::Rule rule;
+    string target;
+    for (auto& name:mActiveFlocks){
+        for (auto& a:mBehaviours.at(name).actions){
+            if (!neighborRule(a, name, rule, target) || target.empty()) continue;
+            if (mFlocks.find(target) == mFlocks.end()) continue;
+            FlockSnapshot* snapshot = &mWorld.add(target, rule.threshold, useSpatialGrid);
+            auto same = [&](const std::pair<string, FlockSnapshot*>& t){return t.second == snapshot;};
+            if (std::none_of(mTargets.begin(), mTargets.end(), same))
+                mTargets.push_back({target, snapshot});
+        }
+    }
+    mPool.parallelFor(0, mTargets.size(), 1, [&](size_t begin, size_t end, size_t){
+        for (size_t k = begin; k < end; k++)
+            mTargets[k].second->capture(mFlocks.at(mTargets[k].first).store(), bounds);
+    });
+}
+
+// largest threshold of the rules a flock applies to itself,
+// used as the grid cell size
+float Runtime::neighborRadius(const Behaviour& b){
+    float radius = 0;
+    NeighborRules::Rule rule;
+    string target;
+    for (auto& a:b.actions){
+        if (neighborRule(a, b.flockName, rule, target) && target.empty())
+            radius = std::max(radius, rule.threshold);
+    }
+    return radius;
+}
+
+// Render thread side: draws the latest published tick, interpolated.
 void Runtime::draw(){
+    mWidth = app::getWindowWidth();
+    mHeight = app::getWindowHeight();
+    adoptTerrain();
     gl::clear(bgColor);
-    mCorpus.draw();
-    for(auto& f:mFlocks) f.second.draw();
+    mCorpus->draw();
+    mFrames.read().draw(frameClock());
+}
+
+// Swaps in a terrain the loader finished. Its GL resources are made here
+// first, so the swap itself is a pointer exchange with the simulation
+// paused between ticks. Additions and refined layouts are merged into
+// the current terrain the same way; ones for a replaced terrain are
+// dropped. A terrain laid out linearly is refined next.
+void Runtime::adoptTerrain(){
+    freeRetired();
+    LoadedTerrain loaded = mLoader.take();
+    if (loaded.corpus) applyTerrain(loaded);
+    // only now may the next job read the corpus
+    mLoader.next();
+}
+
+void Runtime::applyTerrain(LoadedTerrain& loaded){
+    if (loaded.addition || loaded.layout){
+        if (loaded.corpus != mCorpus) return;
+        pause();
+        if (loaded.addition) mCorpus->add(*loaded.addition);
+        else mCorpus->setLayout(*loaded.layout);
+        resume();
+        return;
+    }
+    loaded.corpus->prepareDraw();
+    pause();
+    swapCorpus(std::move(loaded.corpus));
+    resume();
+    if (mCorpus->mNeedsRefine) mLoader.refine(mCorpus);
+}
+
+// simulation paused: nothing else reads the synths' corpus
+void Runtime::swapCorpus(std::shared_ptr<Corpus> next){
+    for (auto& f:mFlocks) f.second.setCorpus(next.get());
+    mVoices.setCorpus(next.get());
+    GranularMixer* mixer = next->mEngine == 1 ? GranularMixer::get(next.get()) : GranularMixer::find();
+    if (mixer){
+        mixer->setCorpus(next.get());
+        mixer->setMaxGrains(mMaxGrains);
+    }
+    mRetired.push_back(std::move(mCorpus));
+    mCorpus = std::move(next);
+}
+
+void Runtime::freeRetired(){
+    GranularMixer* mixer = GranularMixer::find();
+    auto unused = [&](const std::shared_ptr<Corpus>& c){return !mixer || !mixer->uses(c.get());};
+    mRetired.erase(std::remove_if(mRetired.begin(), mRetired.end(), unused), mRetired.end());
+}
+
+bool Runtime::isLoading() const{
+    return mLoader.busy();
+}
+
+float Runtime::loadProgress() const{
+    return mLoader.progress();
+}
+
+string Runtime::loadingFile() const{
+    return mLoader.file().filename().string();
+}
+
+const char* Runtime::loadingTask() const{
+    return mLoader.task();
+}
+
+// render thread, like everything that reads the loader's result
+const std::string& Runtime::loadError() const{
+    return mLoader.error();
 }
 
 bool Runtime::hasFlock(std::string name){
@@ -70,22 +353,35 @@ bool Runtime::hasFlock(std::string name){
            != mFlockNames.end();
 }
 
+// Called from the UI thread. Flock behaviours are queued for the next
+// tick, world actions change flocks and terrain so they run here with
+// the simulation paused.
 bool Runtime::addBehaviour(Behaviour b){
-    if (b.flockName == "world") return runWorldActions(b);
-    else if (hasFlock(b.flockName)){
-        mBehaviours[b.flockName] = b;
-        return true;
+    if (b.flockName == "world"){
+        pause();
+        bool result = runWorldActions(b);
+        resume();
+        return result;
     }
+    else if (hasFlock(b.flockName)) return mCommands.push(std::move(b));
     else return false;
 }
 
 void Runtime::runFlockActions(Behaviour& b){
-    Flock f = mFlocks.at(b.flockName);
+    Flock& f = mFlocks.at(b.flockName);
 
     auto iter = b.actions.begin();
     while (iter != b.actions.end()){
         auto a = *iter;
         if (a == nullptr) continue;
+        size_t fused = runNeighborActions(f, b.flockName, iter, b.actions.end());
+        if (fused > 0){
+            for (size_t k = 0; k < fused; k++){
+                if ((*iter)->freq == 0) iter = b.actions.erase(iter);
+                else iter++;
+            }
+            continue;
+        }
         switch(a->type){
             case  ActionType::go:
             {
@@ -127,7 +423,7 @@ void Runtime::runFlockActions(Behaviour& b){
 
             case ActionType::stop:
             {
-                stop* g = static_cast<stop*>(a.get());
+                actions::stop* g = static_cast<actions::stop*>(a.get());
                 f.stop(g->freq);
                 break;
             }
@@ -143,22 +439,36 @@ void Runtime::runFlockActions(Behaviour& b){
                 f.seek(g->x, g->y, g->freq);
                 break;
             }
+            case ActionType::timbre:
+            {
+                timbre* g = static_cast<timbre*>(a.get());
+                std::vector<vec2> targets;
+                if (mCorpus && mCorpus->timbreTargets(g->cluster, g->target, simBounds(), targets))
+                    f.timbre(targets, g->freq);
+                break;
+            }
             case ActionType::avoid:
             {
                 avoid* g = static_cast<avoid*>(a.get());
-                f.avoid(g->threshold, g->strength, g->target, g->freq);
+                const NeighborSource* target;
+                if (resolveTarget(g->target, b.flockName, target))
+                    f.avoid(g->threshold, g->strength, target, g->freq);
                 break;
             }
             case ActionType::join:
             {
                 join* g = static_cast<join*>(a.get());
-                f.join(g->threshold, g->strength, g->target, g->freq);
+                const NeighborSource* target;
+                if (resolveTarget(g->target, b.flockName, target))
+                    f.join(g->threshold, g->strength, target, g->freq);
                 break;
             }
             case ActionType::align:
             {
                 actions::align* g = static_cast<actions::align*>(a.get());
-                f.align(g->threshold, g->strength, g->target, g->freq);
+                const NeighborSource* target;
+                if (resolveTarget(g->target, b.flockName, target))
+                    f.align(g->threshold, g->strength, target, g->freq);
                 break;
             }
 
@@ -183,12 +493,84 @@ void Runtime::runFlockActions(Behaviour& b){
     }
 }
 
+// Reads an avoid/join/align action. target is left empty when the
+// action applies to the flock itself.
+bool Runtime::neighborRule(const ActionRef& a, const string& self,
+                           NeighborRules::Rule& rule, string& target){
+    if (a == nullptr) return false;
+    switch(a->type){
+        case ActionType::avoid:
+        {
+            avoid* g = static_cast<avoid*>(a.get());
+            rule = {NeighborRule::avoid, g->threshold, g->strength};
+            target = g->target;
+            break;
+        }
+        case ActionType::join:
+        {
+            join* g = static_cast<join*>(a.get());
+            rule = {NeighborRule::join, g->threshold, g->strength};
+            target = g->target;
+            break;
+        }
+        case ActionType::align:
+        {
+            actions::align* g = static_cast<actions::align*>(a.get());
+            rule = {NeighborRule::align, g->threshold, g->strength};
+            target = g->target;
+            break;
+        }
+        default: return false;
+    }
+    if (target == self) target.clear();
+    return true;
+}
+
+// source is null for the flock itself, false if the target is unknown
+bool Runtime::resolveTarget(const string& target, const string& self,
+                            const NeighborSource*& source){
+    source = nullptr;
+    if (target.empty() || target == self) return true;
+    source = mWorld.find(target);
+    return source != nullptr;
+}
+
+// Runs consecutive avoid/join/align actions on the same target as one
+// fused neighbor pass. Returns the number of actions consumed, 0 if there
+// is nothing to fuse.
+size_t Runtime::runNeighborActions(Flock& f, const string& self,
+                                   vector<ActionRef>::iterator begin,
+                                   vector<ActionRef>::iterator end){
+    std::array<bool, 3> seen{false, false, false};
+    size_t n = 0;
+    NeighborRules::Rule rule;
+    string target, first;
+    for (auto it = begin; it != end && neighborRule(*it, self, rule, target); ++it){
+        if (n == 0) first = target;
+        if (seen[int(rule.type)] || target != first) break;
+        seen[int(rule.type)] = true;
+        n++;
+    }
+    if (n < 2) return 0;
+    const NeighborSource* source;
+    if (!resolveTarget(first, self, source)) return n;
+    NeighborRules rules;
+    for (auto it = begin; it != begin + n; ++it){
+        neighborRule(*it, self, rule, target);
+        if (f.evalFreq((*it)->freq)) rules.add(rule.type, rule.threshold, rule.strength);
+    }
+    if (rules.count > 0) f.boids(rules, source);
+    return n;
+}
+
 bool Runtime::runWorldActions(Behaviour b){
     bool result;
     for (auto&& a:b.actions){
         if(a->type == ActionType::make){result = addFlock(a);}
         else if (a->type == ActionType::map){result = makeMap(a);}
+        else if (a->type == ActionType::add){result = addToMap(a);}
         else if (a->type == ActionType::background){result = changeBackground(a);}
+        else if (a->type == ActionType::grains){result = setMaxGrains(a);}
         else return false;
     }
     return result;
@@ -200,13 +582,30 @@ bool Runtime::changeBackground(ActionRef a){
     return true;
 }
 
+bool Runtime::setMaxGrains(ActionRef a){
+    grains* g = (grains*)(a.get());
+    mMaxGrains = g->max;
+    // no mixer yet on image or empty terrains, swapCorpus applies it
+    if (GranularMixer* mixer = GranularMixer::find()) mixer->setMaxGrains(mMaxGrains);
+    return true;
+}
+
 bool Runtime::addFlock(ActionRef a){
     make* m = (make*)(a.get());
     string icon = m->icon;
     if (mIcons.find(icon) != mIcons.end()) icon = mIcons[icon];
-    Flock f = Flock(m->num, icon, m->color, &mCorpus);
+    auto existing = mFlocks.find(m->name);
+    if (existing != mFlocks.end()){
+        existing->second.release();
+        mFlocks.erase(existing);
+        mWorld.remove(m->name);
+    }
+    else mFlockNames.push_back(m->name);
+    // the same name gets the same stream, so a script replays identically
+    Rng rng(sessionSeed(), std::hash<string>{}(m->name));
+    Flock f = Flock(m->num, icon, m->color, mCorpus.get(), &mVoices, rng, simBounds());
+    f.setPool(&mPool);
     mFlocks.emplace(std::make_pair(m->name,f));
-    mFlockNames.push_back(m->name);
     return true;
 }
 
@@ -215,20 +614,20 @@ bool Runtime::makeMap(ActionRef a){
     map* m = (map*)(a.get());
     fs::path filePath = app::getAssetPath(m->file);
     if (filePath.empty()) return false;
-    if (filePath.extension() == ".png"){
-            mCorpus.mChannel = loadImage(app::loadAsset(filePath));
-            mCorpus.mTexture = gl::Texture2d::create(mCorpus.mChannel);
-            mCorpus.mEngine = 0;
-    }
-    else if (filePath.extension() == ".wav"){
-            auto ctx = audio::Context::master();
-            auto src = audio::load(app::loadAsset(filePath));
-            auto buf = src->loadBuffer();
-            mCorpus.slice(buf, src->getSampleRate());
-            mCorpus.project();
-            mCorpus.makeWaves();
-            mCorpus.mEngine = 1;
-    }
-    else return false;
-    return true;
+    bool folder = fs::is_directory(filePath);
+    if (!folder && filePath.extension() != ".png" && filePath.extension() != ".wav") return false;
+    // built in the background, draw() swaps it in when done
+    return mLoader.start(filePath, m->descriptors, m->mapped);
+}
+
+// Grows a sound terrain by a file or folder, analyzed in the background
+// and merged by draw(). Anything else is replaced, as map does.
+bool Runtime::addToMap(ActionRef a){
+    actions::add* m = (actions::add*)(a.get());
+    fs::path filePath = app::getAssetPath(m->file);
+    if (filePath.empty()) return false;
+    bool folder = fs::is_directory(filePath);
+    if (!folder && filePath.extension() != ".wav") return false;
+    if (mCorpus->mEngine != 1) return mLoader.start(filePath);
+    return mLoader.add(mCorpus, filePath);
 }
@@ -0,0 +1,13 @@
+#pragma once
+
+// Instruction sets the SIMD kernels are built for. SSE2 is part of x86-64,
+// AVX2 functions are compiled with a target attribute and picked at runtime.
+#if defined(__x86_64__) || defined(_M_X64)
+#define BRUNZIT_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(BRUNZIT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define BRUNZIT_AVX2 1
+#define BRUNZIT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
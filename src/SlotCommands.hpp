@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "SpscQueue.hpp"
+
+// Latest value per slot, sent from any number of control threads to one
+// consumer thread. Each producer thread pushes into its own ring, so
+// every ring has a single producer, and keeps that ring however many
+// instances it pushes to in between. Rings are drained one after another,
+// so commands for one slot sent from different threads can come out of
+// order; each is stamped with a per-slot sequence number and the consumer
+// skips any older than the last one it applied for that slot.
+template<typename T>
+class SlotCommands{
+    public:
+        SlotCommands(size_t numSlots, size_t perProducer);
+        // any thread, false if the ring of the calling thread is full
+        bool push(size_t slot, const T& value);
+        // consumer thread, fn(slot, value) for each command newer than
+        // the last one applied to its slot
+        template<typename F> void drain(F&& fn);
+        static const size_t MAX_PRODUCERS = 256;
+
+    private:
+        struct Command{
+            size_t slot;
+            uint32_t seq;
+            T value;
+        };
+        using Queue = SpscQueue<Command>;
+        Queue* producerQueue();
+        static uint64_t nextId();
+
+        const uint64_t mId{nextId()};// never reused, unlike addresses
+        size_t mPerProducer;
+        std::vector<std::atomic<uint32_t>> mSent;// last sequence per slot
+        std::vector<uint32_t> mApplied;// consumer thread
+        std::array<std::atomic<Queue*>, MAX_PRODUCERS> mQueues;
+        std::atomic<size_t> mNumQueues{0};
+        std::vector<std::unique_ptr<Queue>> mOwnedQueues;
+        std::unordered_map<std::thread::id, Queue*> mThreadQueues;
+        std::mutex mQueueMutex;
+};
+
+template<typename T>
+SlotCommands<T>::SlotCommands(size_t numSlots, size_t perProducer):
+    mPerProducer(perProducer), mSent(numSlots), mApplied(numSlots, 0){
+    for (auto& s:mSent) s = 0;
+    for (auto& q:mQueues) q = nullptr;
+}
+
+template<typename T>
+uint64_t SlotCommands<T>::nextId(){
+    static std::atomic<uint64_t> id{0};
+    return ++id;
+}
+
+// The ring of the calling thread, created on its first push. Each thread
+// remembers its rings of the last few instances it pushed to, the lock is
+// only taken on a miss.
+template<typename T>
+typename SlotCommands<T>::Queue* SlotCommands<T>::producerQueue(){
+    struct Cached{
+        uint64_t id;
+        Queue* queue;
+    };
+    thread_local std::array<Cached, 4> cache{};
+    thread_local size_t replace = 0;
+    for (const Cached& c:cache) if (c.id == mId) return c.queue;
+    Queue* queue;
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        auto found = mThreadQueues.find(std::this_thread::get_id());
+        if (found != mThreadQueues.end()) queue = found->second;
+        else{
+            size_t n = mNumQueues.load(std::memory_order_relaxed);
+            if (n == MAX_PRODUCERS) return nullptr;
+            mOwnedQueues.push_back(std::make_unique<Queue>(mPerProducer));
+            queue = mOwnedQueues.back().get();
+            mThreadQueues[std::this_thread::get_id()] = queue;
+            mQueues[n].store(queue, std::memory_order_relaxed);
+            mNumQueues.store(n + 1, std::memory_order_release);
+        }
+    }
+    cache[replace++ % cache.size()] = {mId, queue};
+    return queue;
+}
+
+// sequence numbers wrap, they are compared by difference
+template<typename T>
+bool SlotCommands<T>::push(size_t slot, const T& value){
+    Queue* queue = producerQueue();
+    if (!queue) return false;
+    uint32_t seq = mSent[slot].fetch_add(1, std::memory_order_relaxed) + 1;
+    return queue->push({slot, seq, value});
+}
+
+template<typename T>
+template<typename F>
+void SlotCommands<T>::drain(F&& fn){
+    size_t n = mNumQueues.load(std::memory_order_acquire);
+    Command cmd;
+    for (size_t q = 0; q < n; q++){
+        Queue* queue = mQueues[q].load(std::memory_order_relaxed);
+        while (queue->pop(cmd)){
+            if (int32_t(cmd.seq - mApplied[cmd.slot]) <= 0) continue;
+            mApplied[cmd.slot] = cmd.seq;
+            fn(cmd.slot, cmd.value);
+        }
+    }
+}
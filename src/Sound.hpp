@@ -10,31 +10,29 @@
 using namespace cinder;
 using namespace fluid;
 
+// A segment of the corpus source. mData points into the source the
+// corpus keeps, so a segment is a view and never owns samples.
 class Sound{
 public:
-    Sound(audio::SourceFileRef);
-    Sound(audio::BufferRef, size_t sampleRate);
-    audio::BufferRef mBuffer;
-    RealVector  mfccStats;
+    Sound(const float* data, size_t numFrames, size_t sampleRate);
+    const float* mData;
+    size_t mNumFrames;
+    RealVector  mfccStats;// stats of every descriptor the corpus uses
     RealVector loudnessVec;
     double minLoudness, maxLoudness;
     size_t mSampleRate;
     void makeWave(int x, int y, int width, int heigth,
                   double min, double max);
     void draw();
+    void draw(vec2 pos, vec2 dims);
     gl::BatchRef mWave;
     vec2 mPos;
     vec2 mDims;
 };
 
 
-Sound::Sound(audio::SourceFileRef src){
-    mBuffer = src->loadBuffer();
-    mSampleRate = src->getSampleRate();
-}
-
-Sound::Sound(audio::BufferRef src, size_t sampleRate):
-    mBuffer(src), mSampleRate(sampleRate){}
+Sound::Sound(const float* data, size_t numFrames, size_t sampleRate):
+    mData(data), mNumFrames(numFrames), mSampleRate(sampleRate){}
 
 void Sound::makeWave(int x, int y, int width, int height,
                      double min, double max){
@@ -69,3 +67,12 @@ void Sound::draw(){
     ci::gl::color(ci::Color(0.5, 0.5, 0.5));
     mWave->draw();
 }
+
+// the wave moved and scaled from where makeWave put it
+void Sound::draw(vec2 pos, vec2 dims){
+    gl::ScopedModelMatrix model;
+    gl::translate(pos);
+    gl::scale(dims / mDims);
+    gl::translate(-mPos);
+    draw();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "cinder/Vector.h"
+
+using namespace cinder;
+
+// Uniform bucket grid over the (toroidal) window area.
+// Points are binned with a counting sort so a rebuild is two passes
+// over the positions and no per-cell allocation.
+class SpatialGrid{
+    public:
+        void build(const std::vector<vec2>& positions, float cellSize, vec2 bounds);
+        template<typename F> void query(vec2 pos, float radius, F&& visit) const;
+        template<typename F> void querySpans(vec2 pos, float radius, F&& visit) const;
+
+    private:
+        int wrapIndex(int i, int n) const;
+        int cellX(float x) const;
+        int cellY(float y) const;
+
+        vec2 mBounds{1, 1};
+        float mCellW{1}, mCellH{1};
+        int mCols{1}, mRows{1};
+        std::vector<int> mCellStart;
+        std::vector<int> mItems;
+        std::vector<int> mCells;
+        std::vector<int> mFill;
+};
+
+int SpatialGrid::wrapIndex(int i, int n) const{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+int SpatialGrid::cellX(float x) const{
+    return wrapIndex(int(std::floor(x / mCellW)), mCols);
+}
+
+int SpatialGrid::cellY(float y) const{
+    return wrapIndex(int(std::floor(y / mCellH)), mRows);
+}
+
+void SpatialGrid::build(const std::vector<vec2>& positions, float cellSize, vec2 bounds){
+    mBounds = bounds;
+    cellSize = std::max(cellSize, 1.0f);
+    mCols = std::max(1, int(bounds.x / cellSize));
+    mRows = std::max(1, int(bounds.y / cellSize));
+    mCellW = bounds.x / mCols;
+    mCellH = bounds.y / mRows;
+
+    mCellStart.assign(mCols * mRows + 1, 0);
+    mCells.resize(positions.size());
+    mItems.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++){
+        int c = cellY(positions[i].y) * mCols + cellX(positions[i].x);
+        mCells[i] = c;
+        mCellStart[c + 1]++;
+    }
+    for (size_t c = 1; c < mCellStart.size(); c++)
+        mCellStart[c] += mCellStart[c - 1];
+    mFill.assign(mCellStart.begin(), mCellStart.end() - 1);
+    for (size_t i = 0; i < positions.size(); i++)
+        mItems[mFill[mCells[i]]++] = int(i);
+}
+
+// calls visit(items, n) with the contiguous item range of every cell
+// overlapping the radius, callers still have to test the actual distance
+template<typename F>
+void SpatialGrid::querySpans(vec2 pos, float radius, F&& visit) const{
+    if (mItems.empty()) return;
+    int rx = int(std::ceil(radius / mCellW));
+    int ry = int(std::ceil(radius / mCellH));
+    int cx = cellX(pos.x);
+    int cy = cellY(pos.y);
+    int x0 = cx - rx, x1 = cx + rx;
+    int y0 = cy - ry, y1 = cy + ry;
+    if (x1 - x0 + 1 >= mCols) {x0 = 0; x1 = mCols - 1;}
+    if (y1 - y0 + 1 >= mRows) {y0 = 0; y1 = mRows - 1;}
+    for (int y = y0; y <= y1; y++){
+        int row = wrapIndex(y, mRows) * mCols;
+        for (int x = x0; x <= x1; x++){
+            int c = row + wrapIndex(x, mCols);
+            int n = mCellStart[c + 1] - mCellStart[c];
+            if (n > 0) visit(mItems.data() + mCellStart[c], size_t(n));
+        }
+    }
+}
+
+// calls visit(index) for every point in the cells overlapping the radius
+template<typename F>
+void SpatialGrid::query(vec2 pos, float radius, F&& visit) const{
+    querySpans(pos, radius, [&](const int* items, size_t n){
+        for (size_t k = 0; k < n; k++) visit(items[k]);
+    });
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free queue for one producer thread and one consumer thread.
+// Slots are preallocated and reused, so pushing and popping only move
+// values in and out of them.
+template<typename T>
+class SpscQueue{
+    public:
+        SpscQueue(size_t capacity = 256);
+        bool push(T value);
+        bool pop(T& value);
+        bool empty() const;
+
+    private:
+        std::vector<T> mSlots;
+        size_t mMask;
+        alignas(64) std::atomic<size_t> mHead{0};
+        alignas(64) std::atomic<size_t> mTail{0};
+};
+
+template<typename T>
+SpscQueue<T>::SpscQueue(size_t capacity){
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    mSlots.resize(size);
+    mMask = size - 1;
+}
+
+// producer side, false if the queue is full
+template<typename T>
+bool SpscQueue<T>::push(T value){
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load(std::memory_order_acquire) > mMask) return false;
+    mSlots[tail & mMask] = std::move(value);
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// consumer side, false if the queue is empty
+template<typename T>
+bool SpscQueue<T>::pop(T& value){
+    size_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mTail.load(std::memory_order_acquire)) return false;
+    value = std::move(mSlots[head & mMask]);
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::empty() const{
+    return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+}
@@ -3,67 +3,73 @@
 
 #include "cinder/Rand.h"
 #include "cinder/audio/Context.h"
-#include "cinder/audio/GenNode.h"
-#include "cinder/audio/GainNode.h"
 
 #include "Corpus.hpp"
+#include "Mixer.hpp"
 
 using namespace cinder;
 using namespace std;
 
 class Synth {
     public:
-        Synth(Corpus* c):mCorpus(c){};
+        Synth(Corpus* c, AgentMixer* mixer);
+        virtual ~Synth();
         void start();
         void stop();
         void setVolume(float v);
-        virtual void update(vec2 pos)=0;
+        // bounds are the simulation's, speed is how far the agent moves
+        // per tick; called from simulation threads
+        virtual void update(vec2 pos, vec2 bounds, float speed)=0;
+        virtual int getEngine()=0;
+        virtual void setCorpus(Corpus* c);
     protected:
-        audio::VoiceRef mVoice;
+        AgentMixer* mMixer;
+        size_t mSlot;
         Corpus* mCorpus;
 };
 
+Synth::Synth(Corpus* c, AgentMixer* mixer):
+    mMixer(mixer), mSlot(mixer->allocate()), mCorpus(c){}
+
+Synth::~Synth(){
+    mMixer->release(mSlot);
+}
+
 void Synth::start(){
-    mVoice->setVolume(0.);
-    mVoice->start();
+    mMixer->setVolume(mSlot, 0.);
+    mMixer->setActive(mSlot, true);
 };
 
 void Synth::stop(){
-    mVoice->setVolume(0);
-    mVoice->pause();
+    mMixer->setVolume(mSlot, 0);
+    mMixer->setActive(mSlot, false);
 };
 void Synth::setVolume(float f){
-    mVoice->setVolume(f);
+    mMixer->setVolume(mSlot, f);
 };
 
+// only while nothing calls update, the simulation is paused for it
+void Synth::setCorpus(Corpus* c){
+    mCorpus = c;
+}
+
 // Additive
 
 class AdditiveSynth: public Synth{
     public:
         AdditiveSynth(Corpus* c);
-        void update(vec2 pos) override;
-    private:
-        float mPhase = 0.0f;
-        std::atomic<float> mFreq{440};
+        void update(vec2 pos, vec2 bounds, float speed) override;
+        int getEngine() override {return 0;}
 };
 
-AdditiveSynth::AdditiveSynth(Corpus* c):Synth(c){
-   mPhase = M_PI * (float) rand() / (RAND_MAX);
-    mVoice = audio::Voice::create( [this] ( audio::Buffer *buffer, size_t sampleRate ) {
-       float* channel0 = buffer->getChannel(0);
-       float phaseIncr = ( this->mFreq / (float)sampleRate ) * 2 * (float) M_PI;
-       for( size_t i = 0; i < buffer->getNumFrames(); i++ )    {
-           this->mPhase = fmodf( this->mPhase + phaseIncr, 2 * M_PI );
-           channel0[i] = std::sin( this->mPhase );
-       }
-    });
-    mVoice->setVolume(0.0);//TODO
-    mVoice->start();
+AdditiveSynth::AdditiveSynth(Corpus* c):Synth(c, AdditiveMixer::get()){
+    start();
 }
 
-void AdditiveSynth::update(vec2 pos){
-    float currentColour = mCorpus->mChannel.getValue(pos);
-    mFreq = 20 + 1000 * currentColour;
+void AdditiveSynth::update(vec2 pos, vec2 bounds, float speed){
+    if (!mCorpus->mImage) return;// not an image terrain
+    float currentColour = mCorpus->mImage->sample(pos, bounds, speed);
+    static_cast<AdditiveMixer*>(mMixer)->setFrequency(mSlot, 20 + 1000 * currentColour);
 }
 
 
@@ -72,80 +78,31 @@ void AdditiveSynth::update(vec2 pos){
 class GranularSynth:public Synth{
     public:
         GranularSynth(Corpus* c);
-        void update(vec2 pos) override;
-
+        void update(vec2 pos, vec2 bounds, float speed) override;
+        int getEngine() override {return 1;}
+        void setCorpus(Corpus* c) override;
     private:
-        audio::BufferRef mCurrentBuffer;
-        std::atomic<int> mBufIndex;
-        static const int nOverlap = 8;
-        std::atomic<std::array<float*,nOverlap>> mBuffers;
-        std::atomic<std::array<int,nOverlap>> mIndices;
-        std::atomic<std::array<int,nOverlap>> mOffsets;
-        std::atomic<int> mSampleCount = 0;
-        std::atomic<int> lastTrig = 0;
-        std::atomic<int> mTrigRate;
-        std::atomic<bool> mRandomize{true};
+        // last source the mixer accepted
+        const float* mSource{nullptr};
 };
 
-GranularSynth::GranularSynth(Corpus* c):Synth(c){
-    mTrigRate = mCorpus->ENV_SIZE / nOverlap;
-    auto idx = mIndices.load();
-    for( size_t j = 0; j < nOverlap; j++ ) idx[j] = 0;
-    mIndices.store(idx);
-    
-    auto off = mOffsets.load();
-    for( size_t j = 0; j < nOverlap; j++ ) off[j] = 0;
-    mOffsets.store(off);
-
-    
-    mVoice = audio::Voice::create( [this] ( audio::Buffer* buffer, size_t sampleRate ) {
-        if(mCurrentBuffer == nullptr) return;
-        float *channel0 = buffer->getChannel(0);
-        auto idx = mIndices.load();
-        auto bufs = mBuffers.load();
-        auto off = mOffsets.load();
-
-        for( size_t i = 0; i < buffer->getNumFrames(); i++ ) {
-            float val = 0;
-            // compute sample value
-            for( size_t j = 0; j < nOverlap; j++ ) {
-                if (bufs[j] != nullptr) {
-                    float* data = bufs[j];
-                    val += mCorpus->envelope[idx[j]] * data[off[j] + idx[j]];
-                    idx[j]++;
-                    if ( idx[j] >= mCorpus->ENV_SIZE)  idx[j] = 0;
-                }
-            }
-            channel0[i] = val;
-            // trigger new grains
-            if (mSampleCount++ >= mTrigRate){
-                lastTrig++;
-                if (lastTrig >= nOverlap) lastTrig = 0;
-                bufs[lastTrig] = mCurrentBuffer->getData();
-                idx[lastTrig] = 0;
-                if(mRandomize) off[lastTrig] = int(
-                        (mCorpus->GRAIN_SIZE - mCorpus->ENV_SIZE)*((float) rand() / (RAND_MAX))
-                );
-                mSampleCount = 0;
-            }
-        }
-        mIndices.store(idx);
-        mOffsets.store(off);
-        mBuffers.store(bufs);
-    } );
+GranularSynth::GranularSynth(Corpus* c):Synth(c, GranularMixer::get(c)){
     start();
 }
 
-void GranularSynth::update(vec2 pos) {
+void GranularSynth::setCorpus(Corpus* c){
+    Synth::setCorpus(c);
+    mSource = nullptr;
+}
+
+void GranularSynth::update(vec2 pos, vec2 bounds, float speed) {
     if (!mCorpus->empty()){
-        int x = int(mCorpus->mMaxX * pos[0] / app::getWindowWidth());
-        int y = int(mCorpus->mMaxY * pos[1] / app::getWindowHeight());
-        std::pair<int,int> key = make_pair(x, y);
-        int snd = mCorpus->mPositionsMap[key];
-        mCurrentBuffer = mCorpus->mSounds[snd].mBuffer;
-        auto bufs = mBuffers.load();
-        if(bufs[0] == nullptr) bufs[0] = mCurrentBuffer->getData();
-        mBuffers.store(bufs);
+        int x = int(mCorpus->mMaxX * pos[0] / bounds.x);
+        int y = int(mCorpus->mMaxY * pos[1] / bounds.y);
+        int snd = mCorpus->segmentAt(x, y);
+        const float* source = mCorpus->mSounds[snd].mData;
+        // only changes are sent; a full ring is retried on the next update
+        if (source != mSource && static_cast<GranularMixer*>(mMixer)->setSource(mSlot, source, mCorpus->mGeneration))
+            mSource = source;
     }
 }
-    
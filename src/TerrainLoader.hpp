@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include "Corpus.hpp"
+#include "ThreadPool.hpp"
+
+// What the loader finished: a new corpus to swap in, an addition to merge
+// into the corpus it was analyzed against, or a better layout for it.
+struct LoadedTerrain{
+    std::shared_ptr<Corpus> corpus;
+    std::unique_ptr<Corpus::Addition> addition;
+    std::unique_ptr<Corpus::Layout> layout;
+};
+
+// Builds the next terrain on a background thread while the current one
+// keeps playing. The loader has its own pool, since slot 0 of the
+// simulation pool belongs to the simulation thread. A finished corpus has
+// no GL resources yet; the render thread takes it, prepares it for drawing
+// and swaps it in. Requests made while busy wait in order, and the next
+// one only starts once the caller has applied the last result, since it
+// may read the corpus that result changes.
+class TerrainLoader{
+    public:
+        ~TerrainLoader();
+        // descriptors 0 keeps the corpus default, mapped sets mMapSource
+        bool start(const std::filesystem::path& file, uint32_t descriptors = 0, bool mapped = false);
+        // analyzes file against corpus, which keeps playing meanwhile
+        bool add(std::shared_ptr<Corpus> corpus, const std::filesystem::path& file);
+        // UMAP layout for a corpus that plays with its linear one
+        bool refine(std::shared_ptr<Corpus> corpus);
+        bool busy() const;
+        float progress() const;
+        std::filesystem::path file() const;
+        const char* task() const;
+        // why the last taken job failed, empty once the next one starts
+        const std::string& error() const;
+        // the result once, empty while loading or when loading failed
+        LoadedTerrain take();
+        // starts the oldest waiting request, once a taken result is applied
+        void next();
+
+    private:
+        enum class Job{build, add, refine};
+        struct Request{
+            Job job{Job::build};
+            std::shared_ptr<Corpus> corpus;
+            std::filesystem::path file;
+            uint32_t descriptors{0};
+            bool mapped{false};
+        };
+        bool request(Request r);
+        void run(Request r);
+        void load(Request r);
+
+        std::unique_ptr<ThreadPool> mPool;
+        std::thread mThread;
+        Request mCurrent;
+        std::deque<Request> mQueue;
+        std::unique_ptr<Corpus::Addition> mAddition;
+        std::unique_ptr<Corpus::Layout> mLayout;
+        std::atomic<bool> mBusy{false};
+        std::atomic<bool> mDone{false};
+        bool mFailed{false};
+        std::string mFailure;// written by the job, read after it is joined
+        std::string mError;
+};
+
+TerrainLoader::~TerrainLoader(){
+    if (mThread.joinable()) mThread.join();
+}
+
+bool TerrainLoader::start(const std::filesystem::path& file, uint32_t descriptors, bool mapped){
+    return request({Job::build, nullptr, file, descriptors, mapped});
+}
+
+bool TerrainLoader::add(std::shared_ptr<Corpus> corpus, const std::filesystem::path& file){
+    return request({Job::add, corpus, file});
+}
+
+bool TerrainLoader::refine(std::shared_ptr<Corpus> corpus){
+    return request({Job::refine, corpus, {}});
+}
+
+bool TerrainLoader::request(Request r){
+    if (mBusy || !mQueue.empty()) mQueue.push_back(std::move(r));
+    else run(std::move(r));
+    return true;
+}
+
+void TerrainLoader::run(Request r){
+    if (mThread.joinable()) mThread.join();
+    if (!mPool) mPool = std::make_unique<ThreadPool>();
+    if (r.job == Job::build){
+        r.corpus = std::make_shared<Corpus>();
+        r.corpus->setPool(mPool.get());
+        if (r.descriptors != 0) r.corpus->mDescriptors = r.descriptors;
+        r.corpus->mMapSource = r.mapped;
+    }
+    mCurrent = r;
+    mAddition.reset();
+    mLayout.reset();
+    mFailed = false;
+    mFailure.clear();
+    mError.clear();
+    mDone = false;
+    mBusy = true;
+    mThread = std::thread([this, r]{load(r);});
+}
+
+void TerrainLoader::load(Request r){
+    try{
+        if (r.job == Job::add) mAddition = r.corpus->analyze(r.file);
+        else if (r.job == Job::refine) mLayout = r.corpus->refine();
+        else if (r.file.extension() == ".png") r.corpus->loadImage(r.file);
+        else r.corpus->build(r.file);
+    }
+    catch (const std::exception& e){
+        mFailure = "could not load " + r.file.filename().string() + ": " + e.what();
+        mFailed = true;
+    }
+    mDone = true;
+}
+
+bool TerrainLoader::busy() const{
+    return mBusy;
+}
+
+float TerrainLoader::progress() const{
+    return mBusy ? mCurrent.corpus->mProgress.load() : 0.0f;
+}
+
+std::filesystem::path TerrainLoader::file() const{
+    return mCurrent.file;
+}
+
+const char* TerrainLoader::task() const{
+    switch (mCurrent.job){
+        case Job::add: return "adding";
+        case Job::refine: return "laying out";
+        default: return "loading";
+    }
+}
+
+const std::string& TerrainLoader::error() const{
+    return mError;
+}
+
+LoadedTerrain TerrainLoader::take(){
+    LoadedTerrain result;
+    if (!mBusy || !mDone) return result;
+    mThread.join();
+    mBusy = false;
+    if (!mFailed){
+        result.corpus = mCurrent.corpus;
+        result.addition = std::move(mAddition);
+        result.layout = std::move(mLayout);
+    }
+    else mError = std::move(mFailure);
+    mCurrent.corpus.reset();
+    return result;
+}
+
+void TerrainLoader::next(){
+    if (mBusy || mQueue.empty()) return;
+    Request r = std::move(mQueue.front());
+    mQueue.pop_front();
+    run(std::move(r));
+}
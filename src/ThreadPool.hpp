@@ -0,0 +1,169 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+
+// Persistent pool of workers with one task deque each. A thread pushes
+// and pops at the back of its own deque, idle workers steal from the front
+// of the others. A thread waiting for a parallelFor runs queued tasks
+// while there are any, so parallel loops can be nested, and sleeps
+// when there is nothing left to take.
+// Slot 0 belongs to the thread that calls into the pool from outside.
+class ThreadPool{
+    public:
+        ThreadPool(size_t numThreads = std::thread::hardware_concurrency());
+        ~ThreadPool();
+        size_t size() const;
+        size_t currentSlot() const;
+        template<typename F>
+        void parallelFor(size_t begin, size_t end, size_t grain, F&& fn);
+
+    private:
+        struct Group{
+            std::atomic<size_t> pending{0};
+        };
+        struct Task{
+            std::function<void(size_t)> fn;
+            Group* group;
+        };
+        struct Queue{
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        void push(size_t slot, Task task);
+        bool pop(size_t slot, Task& task);
+        bool steal(size_t slot, Task& task);
+        bool runOne(size_t slot);
+        void work(size_t slot);
+
+        std::vector<std::unique_ptr<Queue>> mQueues;
+        std::vector<std::thread> mThreads;
+        std::mutex mSleepMutex;
+        std::condition_variable mWake;
+        std::atomic<size_t> mQueued{0};
+        std::atomic<bool> mStop{false};
+};
+
+namespace {
+    thread_local const void* tPool = nullptr;
+    thread_local size_t tSlot = 0;
+}
+
+ThreadPool::ThreadPool(size_t numThreads){
+    size_t workers = numThreads > 1 ? numThreads - 1 : 0;
+    for (size_t i = 0; i < workers + 1; i++)
+        mQueues.push_back(std::make_unique<Queue>());
+    for (size_t i = 1; i <= workers; i++)
+        mThreads.emplace_back([this, i]{work(i);});
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto& t:mThreads) t.join();
+}
+
+size_t ThreadPool::size() const{
+    return mQueues.size();
+}
+
+size_t ThreadPool::currentSlot() const{
+    return tPool == this ? tSlot : 0;
+}
+
+void ThreadPool::push(size_t slot, Task task){
+    {
+        std::lock_guard<std::mutex> lock(mQueues[slot]->mutex);
+        mQueues[slot]->tasks.push_back(std::move(task));
+    }
+    mQueued++;
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+    }
+    mWake.notify_one();
+}
+
+bool ThreadPool::pop(size_t slot, Task& task){
+    Queue& q = *mQueues[slot];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    mQueued--;
+    return true;
+}
+
+bool ThreadPool::steal(size_t slot, Task& task){
+    for (size_t k = 1; k < mQueues.size(); k++){
+        Queue& q = *mQueues[(slot + k) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) continue;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        mQueued--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runOne(size_t slot){
+    Task task;
+    if (!pop(slot, task) && !steal(slot, task)) return false;
+    task.fn(slot);
+    if (--task.group->pending == 0){
+        // the owner of the group may be asleep in parallelFor
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mWake.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::work(size_t slot){
+    tPool = this;
+    tSlot = slot;
+    while (!mStop){
+        if (runOne(slot)) continue;
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mWake.wait(lock, [this]{return mStop || mQueued > 0;});
+    }
+}
+
+// Calls fn(begin, end, slot) over chunks of at most grain items.
+// The caller runs the first chunk itself and helps with the rest.
+template<typename F>
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, F&& fn){
+    if (end <= begin) return;
+    size_t slot = currentSlot();
+    grain = std::max<size_t>(grain, 1);
+    if (end - begin <= grain || mThreads.empty()){
+        fn(begin, end, slot);
+        return;
+    }
+    Group group;
+    size_t numChunks = (end - begin + grain - 1) / grain;
+    group.pending = numChunks - 1;
+    for (size_t c = numChunks - 1; c > 0; c--){
+        size_t b = begin + c * grain;
+        size_t e = std::min(end, b + grain);
+        push(slot, {[&fn, b, e](size_t s){fn(b, e, s);}, &group});
+    }
+    fn(begin, std::min(end, begin + grain), slot);
+    while (group.pending > 0){
+        if (runOne(slot)) continue;
+        // the rest is running elsewhere
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mWake.wait(lock, [&]{return group.pending == 0 || mQueued > 0;});
+    }
+}
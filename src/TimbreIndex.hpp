@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <data/FluidDataSet.hpp>
+#include <data/TensorTypes.hpp>
+#include <algorithms/public/KDTree.hpp>
+#include <algorithms/public/KMeans.hpp>
+
+#include "Random.hpp"
+
+using namespace fluid;
+
+// Descriptor-space lookups over the segments of a corpus: a KD-tree for
+// nearest segments and a KMeans clustering with the members of each
+// cluster. Built once per dataset, rows are named by segment index.
+// Queries only read, so flocks can share one.
+class TimbreIndex{
+    public:
+        using DataSet = FluidDataSet<std::string, double, 1>;
+        TimbreIndex(const DataSet& data, index numClusters, uint64_t seed);
+        // the k segments closest to point, closest first
+        void nearest(RealVectorView point, index k, std::vector<int>& out) const;
+        index numClusters() const;
+        RealVector mean(index cluster) const;
+        int random(index cluster, Rng& rng) const;
+
+    private:
+        algorithm::KDTree mTree;
+        RealMatrix mMeans;
+        std::vector<std::vector<int>> mMembers;
+};
+
+TimbreIndex::TimbreIndex(const DataSet& data, index numClusters, uint64_t seed):mTree(data){
+    index n = data.size();
+    numClusters = std::min(numClusters, n);
+    if (numClusters == 0) return;
+    algorithm::KMeans kmeans;
+    kmeans.train(data, numClusters, 100, algorithm::KMeans::InitMethod::randomPartition,
+                 index(seed & 0x7fffffff));
+    mMeans = RealMatrix(numClusters, data.dims());
+    kmeans.getMeans(mMeans);
+    FluidTensor<index, 1> assignments(n);
+    kmeans.getAssignments(assignments);
+    mMembers.resize(numClusters);
+    auto ids = data.getIds();
+    for (index i = 0; i < n; i++) mMembers[assignments(i)].push_back(std::stoi(ids(i)));
+}
+
+void TimbreIndex::nearest(RealVectorView point, index k, std::vector<int>& out) const{
+    out.clear();
+    auto result = mTree.kNearest(point, k);
+    for (auto id:result.second) out.push_back(std::stoi(*id));
+}
+
+index TimbreIndex::numClusters() const{
+    return mMeans.rows();
+}
+
+RealVector TimbreIndex::mean(index cluster) const{
+    return RealVector(mMeans.row(cluster));
+}
+
+// any segment of cluster, -1 for an empty or unknown cluster
+int TimbreIndex::random(index cluster, Rng& rng) const{
+    if (cluster < 0 || cluster >= numClusters() || mMembers[cluster].empty()) return -1;
+    const std::vector<int>& members = mMembers[cluster];
+    return members[std::min(size_t(rng.uniform() * members.size()), members.size() - 1)];
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+// Lock-free hand-off of the latest value from one writer to one reader.
+// The writer fills back() and publishes it, the reader always gets the
+// most recently published buffer. Buffers are recycled, never reallocated.
+template<typename T>
+class TripleBuffer{
+    public:
+        T& back();
+        void publish();
+        const T& read();
+
+    private:
+        static const int FRESH = 4;
+        static const int INDEX = 3;
+        std::array<T, 3> mBuffers;
+        std::atomic<int> mMiddle{1};
+        int mBack{0};
+        int mFront{2};
+};
+
+template<typename T>
+T& TripleBuffer<T>::back(){
+    return mBuffers[mBack];
+}
+
+template<typename T>
+void TripleBuffer<T>::publish(){
+    mBack = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel) & INDEX;
+}
+
+template<typename T>
+const T& TripleBuffer<T>::read(){
+    if (mMiddle.load(std::memory_order_acquire) & FRESH)
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & INDEX;
+    return mBuffers[mFront];
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <memory>
+#include "Corpus.hpp"
+#include "Synth.hpp"
+
+using SynthRef = shared_ptr<Synth>;
+
+// Free list of stopped synths, one per engine, so agents created by
+// make reuse the audio::Voice of agents that died instead of adding
+// graph nodes. Used by the simulation thread between ticks and by the
+// UI thread while the simulation is paused, never concurrently.
+class VoicePool{
+    public:
+        SynthRef acquire(Corpus* c);
+        void release(SynthRef synth);
+        size_t size();
+        void setCorpus(Corpus* c);
+    private:
+        size_t engine(Corpus* c);
+        std::array<std::vector<SynthRef>, 2> mFree;
+};
+
+size_t VoicePool::engine(Corpus* c){
+    return c->mEngine == 0 ? 0 : 1;
+}
+
+SynthRef VoicePool::acquire(Corpus* c){
+    std::vector<SynthRef>& free = mFree[engine(c)];
+    if (free.empty()){
+        if(c->mEngine == 0) return SynthRef(new AdditiveSynth(c));
+        else return SynthRef(new GranularSynth(c));
+    }
+    SynthRef synth = std::move(free.back());
+    free.pop_back();
+    synth->start();
+    return synth;
+}
+
+void VoicePool::release(SynthRef synth){
+    if (!synth) return;
+    synth->stop();
+    mFree[synth->getEngine() == 0 ? 0 : 1].push_back(std::move(synth));
+}
+
+void VoicePool::setCorpus(Corpus* c){
+    for (auto& free:mFree)
+        for (auto& synth:free) synth->setCorpus(c);
+}
+
+size_t VoicePool::size(){
+    return mFree[0].size() + mFree[1].size();
+}
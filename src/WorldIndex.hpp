@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <numeric>
+#include <unordered_map>
+#include "Agent.hpp"
+#include "SpatialGrid.hpp"
+
+using std::string;
+
+// What a flock rule needs to enumerate neighbors in some set of agents.
+// grid is null for a brute force scan over all.
+struct NeighborSource{
+    const vec2* positions;
+    const vec2* velocities;
+    const uint8_t* alive;
+    const int* all;
+    size_t size;
+    const SpatialGrid* grid;
+};
+
+// Copy of a flock's kinematic state taken at the start of a tick,
+// with its own grid. Other flocks read it while the flock itself moves,
+// so cross-flock rules don't depend on task scheduling.
+struct FlockSnapshot{
+    std::vector<vec2> positions;
+    std::vector<vec2> velocities;
+    std::vector<uint8_t> alive;
+    std::vector<int> all;
+    SpatialGrid grid;
+    NeighborSource source{};
+    float cellSize{0};
+    bool useGrid{true};
+
+    void capture(const AgentStore& store, vec2 bounds);
+};
+
+// Snapshots of every flock that is the target of another flock's rules,
+// built once per tick by Runtime and shared by all flocks.
+class WorldIndex{
+    public:
+        void clear();
+        FlockSnapshot& add(const string& name, float cellSize, bool useGrid);
+        // drops the snapshot of a flock that is gone or replaced
+        void remove(const string& name);
+        const NeighborSource* find(const string& name) const;
+    private:
+        std::unordered_map<string, FlockSnapshot> mSnapshots;
+};
+
+void FlockSnapshot::capture(const AgentStore& store, vec2 bounds){
+    positions = store.positions;
+    velocities = store.velocities;
+    alive = store.alive;
+    if (all.size() != positions.size()){
+        all.resize(positions.size());
+        std::iota(all.begin(), all.end(), 0);
+    }
+    if (useGrid) grid.build(positions, cellSize, bounds);
+    source = {positions.data(), velocities.data(), alive.data(),
+              all.data(), positions.size(), useGrid ? &grid : nullptr};
+}
+
+void WorldIndex::clear(){
+    for (auto& s:mSnapshots) s.second.cellSize = 0;
+}
+
+// registers name as a target, growing its cell size to the largest
+// threshold used against it this tick
+FlockSnapshot& WorldIndex::add(const string& name, float cellSize, bool useGrid){
+    FlockSnapshot& s = mSnapshots[name];
+    s.cellSize = std::max(s.cellSize, cellSize);
+    s.useGrid = useGrid;
+    return s;
+}
+
+void WorldIndex::remove(const string& name){
+    mSnapshots.erase(name);
+}
+
+const NeighborSource* WorldIndex::find(const string& name) const{
+    auto found = mSnapshots.find(name);
+    if (found == mSnapshots.end() || found->second.cellSize <= 0) return nullptr;
+    return &found->second.source;
+}
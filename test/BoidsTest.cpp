@@ -0,0 +1,66 @@
+// Flock::boids must move agents exactly as avoid, join and align run one
+// after another. Two flocks start from the same seed; one runs the rules
+// separately, the other fused, as Runtime::runNeighborActions does, and
+// positions and velocities must stay bit for bit equal. Covers the grid
+// and the brute force scan, on the flock itself and on another flock.
+
+#include <cstdio>
+#include "Flock.hpp"
+
+static const vec2 bounds(640, 360);
+
+static size_t differences(Flock& a, Flock& b){
+    const AgentStore& x = a.store();
+    const AgentStore& y = b.store();
+    if (x.size() != y.size()) return x.size() + y.size();
+    size_t n = 0;
+    for (size_t i = 0; i < x.size(); i++)
+        if (!(x.positions[i] == y.positions[i]) || !(x.velocities[i] == y.velocities[i])) n++;
+    return n;
+}
+
+static size_t run(bool useGrid, bool crossFlock, ThreadPool& pool){
+    Flock separate(400, "triangle", "white", nullptr, nullptr, Rng(7, 0), bounds);
+    Flock fused(400, "triangle", "white", nullptr, nullptr, Rng(7, 0), bounds);
+    Flock other(300, "triangle", "white", nullptr, nullptr, Rng(7, 1), bounds);
+    separate.setPool(&pool);
+    fused.setPool(&pool);
+    FlockSnapshot snapshot;
+    snapshot.cellSize = 50;
+    snapshot.useGrid = useGrid;
+    snapshot.capture(other.store(), bounds);
+    const NeighborSource* target = crossFlock ? &snapshot.source : nullptr;
+    NeighborRules rules;
+    rules.add(NeighborRule::avoid, 20, 1.5);
+    rules.add(NeighborRule::join, 50, 1);
+    rules.add(NeighborRule::align, 35, 0.8);
+    for (int step = 0; step < 200; step++){
+        separate.index(50, useGrid);
+        separate.avoid(20, 1.5, target);
+        separate.join(50, 1, target);
+        separate.align(35, 0.8, target);
+        separate.wander(0.1);
+        separate.go(1);
+
+        fused.index(50, useGrid);
+        for (size_t r = 0; r < rules.count; r++) fused.evalFreq(3);
+        fused.boids(rules, target);
+        fused.wander(0.1);
+        fused.go(1);
+    }
+    return differences(separate, fused);
+}
+
+int main(){
+    ThreadPool pool(4);
+    size_t failed = 0;
+    for (bool useGrid:{true, false}){
+        for (bool crossFlock:{false, true}){
+            size_t n = run(useGrid, crossFlock, pool);
+            std::printf("%s, %s: %zu agents differ\n", useGrid ? "grid" : "scan",
+                        crossFlock ? "other flock" : "own flock", n);
+            if (n > 0) failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// The simulation must not depend on how many threads run it. Three
+// seeded flocks tick the way Runtime::update runs them: dead agents are
+// compacted, flocks that others target are snapshot, then every flock runs
+// its rules as a task, each rule split in agent ranges on the same pool.
+// A pool of one thread and a pool of eight must end in the same state.
+
+#include <cstdio>
+#include <vector>
+#include "Flock.hpp"
+
+static const vec2 bounds(900, 500);
+
+struct World{
+    std::vector<Flock> flocks;
+    FlockSnapshot target;// of flock 1, avoided by flock 0
+};
+
+static void tick(World& w, ThreadPool& pool){
+    for (auto& f:w.flocks) f.compact();
+    w.target.cellSize = 40;
+    w.target.capture(w.flocks[1].store(), bounds);
+    pool.parallelFor(0, w.flocks.size(), 1, [&](size_t begin, size_t end, size_t){
+        for (size_t k = begin; k < end; k++){
+            Flock& f = w.flocks[k];
+            f.index(50);
+            if (k == 0) f.avoid(40, 2, &w.target.source);
+            NeighborRules rules;
+            rules.add(NeighborRule::avoid, 15, 1.5);
+            rules.add(NeighborRule::join, 50, 1);
+            rules.add(NeighborRule::align, 30, 1);
+            f.boids(rules, nullptr);
+            f.join(25, 0.5, nullptr, 2);
+            f.wander(0.2);
+            f.die(0.002, 1);
+            f.go(1);
+        }
+    });
+}
+
+static World run(size_t threads){
+    ThreadPool pool(threads);
+    World w;
+    for (uint64_t k = 0; k < 3; k++){
+        w.flocks.emplace_back(600, "triangle", "white", nullptr, nullptr, Rng(11, k), bounds);
+        w.flocks.back().setPool(&pool);
+    }
+    for (int t = 0; t < 300; t++) tick(w, pool);
+    for (auto& f:w.flocks) f.setPool(nullptr);
+    return w;
+}
+
+int main(){
+    World one = run(1), many = run(8);
+    size_t differ = 0, agents = 0;
+    for (size_t k = 0; k < one.flocks.size(); k++){
+        const AgentStore& a = one.flocks[k].store();
+        const AgentStore& b = many.flocks[k].store();
+        if (a.size() != b.size()){
+            differ += a.size() + b.size();
+            continue;
+        }
+        for (size_t i = 0; i < a.size(); i++){
+            agents++;
+            if (!(a.positions[i] == b.positions[i]) || !(a.velocities[i] == b.velocities[i]) ||
+                a.alive[i] != b.alive[i]) differ++;
+        }
+    }
+    std::printf("%zu agents left, %zu differ between 1 and 8 threads\n", agents, differ);
+    return differ == 0 && agents > 0 ? 0 : 1;
+}
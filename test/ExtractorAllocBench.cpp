@@ -0,0 +1,91 @@
+// Heap allocations and time of extractor::extract with every descriptor,
+// on a synthetic signal. Counts come from replacing operator new, so
+// allocations that bypass it (malloc in Eigen or in the arena's blocks)
+// are not seen. After a warm-up a short and a long segment must allocate
+// the same, none per frame, and extracting into a segment again must
+// not allocate at all.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "Extractor.hpp"
+#include "Random.hpp"
+
+static std::atomic<bool> gCounting{false};
+static std::atomic<size_t> gAllocations{0};
+
+void* operator new(size_t size){
+    if (gCounting) gAllocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept{
+    std::free(p);
+}
+
+struct Count{
+    size_t allocations;
+    double ms;
+};
+
+static Count measure(extractor& ex, Sound& snd, uint32_t descriptors){
+    gAllocations = 0;
+    gCounting = true;
+    auto start = std::chrono::steady_clock::now();
+    ex.extract(snd, descriptors);
+    auto end = std::chrono::steady_clock::now();
+    gCounting = false;
+    return {gAllocations, std::chrono::duration<double, std::milli>(end - start).count()};
+}
+
+int main(){
+    const size_t sampleRate = 44100;
+    const uint32_t all = DESC_MFCC | DESC_SHAPE | DESC_LOUDNESS | DESC_PITCH;
+    // a gliding tone with noise, so every descriptor has work to do
+    std::vector<float> signal(sampleRate * 10);
+    Rng rng(2, 0);
+    double phase = 0;
+    for (size_t i = 0; i < signal.size(); i++){
+        phase += (220 + 660.0 * i / signal.size()) / sampleRate;
+        signal[i] = 0.5f * std::sin(2 * M_PI * phase) + 0.05f * rng.uniform(-1, 1);
+    }
+    const size_t shortFrames = 8, longFrames = 800;
+    auto samples = [](size_t frames){return (frames - 1) * extractor::hopSize;};
+    extractor ex;
+    // warm-up grows the arena and the feature matrix to the longest segment
+    Sound warm(signal.data(), samples(longFrames), sampleRate);
+    ex.extract(warm, all);
+
+    Sound shortSegment(signal.data(), samples(shortFrames), sampleRate);
+    Sound longSegment(signal.data() + sampleRate, samples(longFrames), sampleRate);
+    Count s = measure(ex, shortSegment, all);
+    Count l = measure(ex, longSegment, all);
+    Count again = measure(ex, longSegment, all);
+    std::printf("%6zu frames: %zu allocations, %.3f ms\n", shortFrames, s.allocations, s.ms);
+    std::printf("%6zu frames: %zu allocations, %.3f ms, %.1f us per frame\n", longFrames,
+                l.allocations, l.ms, 1000 * l.ms / longFrames);
+    std::printf("extracted again: %zu allocations\n", again.allocations);
+    bool perFrame = l.allocations > s.allocations;
+    return perFrame || again.allocations > 0 ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+// The image terrain pyramid against one built here: level 0 holds the
+// image, every other level is the 2x2 box filter of the one above with
+// its edges clamped. An odd sized image leaves partial tiles and odd
+// levels. sample() must read the level whose texels are as wide as the
+// step, and a second terrain opening the same image must read the cached
+// files back, unchanged, and sample exactly as the first did.
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include "ImageTerrain.hpp"
+
+namespace fs = std::filesystem;
+
+struct Grid{
+    int32_t width, height;
+    std::vector<float> values;
+    float at(int32_t x, int32_t y) const{
+        x = std::clamp(x, 0, width - 1);
+        y = std::clamp(y, 0, height - 1);
+        return values[size_t(y) * width + x];
+    }
+};
+
+static Grid half(const Grid& g){
+    Grid out{(g.width + 1) / 2, (g.height + 1) / 2, {}};
+    for (int32_t y = 0; y < out.height; y++)
+        for (int32_t x = 0; x < out.width; x++)
+            out.values.push_back(0.25f * (g.at(2 * x, 2 * y) + g.at(2 * x + 1, 2 * y) +
+                                          g.at(2 * x, 2 * y + 1) + g.at(2 * x + 1, 2 * y + 1)));
+    return out;
+}
+
+// texel (x, y) of a level through sample(), with the image over its own size
+static float read(const ImageTerrain& t, const Grid& level, const Grid& top, int32_t x, int32_t y, float speed){
+    vec2 bounds(top.width, top.height);
+    vec2 pos((x + 0.5f) * top.width / level.width, (y + 0.5f) * top.height / level.height);
+    return t.sample(pos, bounds, speed);
+}
+
+int main(){
+    fs::path dir = fs::temp_directory_path() / "brunzit-image-test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path file = dir / "terrain.png";
+    const int32_t width = 601, height = 403;
+    Channel8u image(width, height);
+    Grid top{width, height, {}};
+    for (int32_t y = 0; y < height; y++){
+        for (int32_t x = 0; x < width; x++){
+            uint8_t v = uint8_t((uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u) >> 7);
+            image.setValue(ivec2(x, y), v);
+            top.values.push_back(v / 255.0f);
+        }
+    }
+    writeImage(file, image);
+    std::vector<Grid> levels{top};
+    while (levels.back().width > ImageTerrain::TILE || levels.back().height > ImageTerrain::TILE)
+        levels.push_back(half(levels.back()));
+
+    ThreadPool pool(4);
+    std::atomic<float> progress{0};
+    ImageTerrain built(dir);
+    built.open(file, &pool, progress);
+    size_t failed = 0;
+    if (built.numLevels() != levels.size()){
+        std::printf("%zu levels, expected %zu\n", built.numLevels(), levels.size());
+        return 1;
+    }
+
+    // every texel of every level, read at a speed inside the level's octave
+    for (size_t l = 0; l < levels.size(); l++){
+        const Grid& g = levels[l];
+        float speed = 1.5f * float(1 << l);
+        size_t wrong = 0;
+        for (int32_t y = 0; y < g.height; y++)
+            for (int32_t x = 0; x < g.width; x++)
+                if (std::fabs(read(built, g, top, x, y, speed) - g.at(x, y)) > 1e-6f) wrong++;
+        std::printf("level %zu: %dx%d, %zu texels differ\n", l, g.width, g.height, wrong);
+        failed += wrong;
+    }
+
+    // speeds at the octave edges, and bounds that shrink the image
+    struct Case{
+        float speed;
+        float shrink;// image texels per unit of bounds
+        size_t level;
+    };
+    const Case cases[] = {{0.1f, 1, 0}, {1, 1, 0}, {1.9f, 1, 0}, {2, 1, 1}, {3.9f, 1, 1},
+                          {4, 1, 2}, {1e6f, 1, levels.size() - 1}, {1.5f, 2, 1}, {1.5f, 4, 2}};
+    for (const Case& c:cases){
+        const Grid& g = levels[c.level];
+        vec2 bounds(top.width / c.shrink, top.height / c.shrink);
+        size_t wrong = 0;
+        for (int32_t k = 0; k < 64; k++){
+            int32_t x = (k * 37) % g.width, y = (k * 53) % g.height;
+            vec2 pos((x + 0.5f) * bounds.x / g.width, (y + 0.5f) * bounds.y / g.height);
+            if (std::fabs(built.sample(pos, bounds, c.speed) - g.at(x, y)) > 1e-6f) wrong++;
+        }
+        if (wrong){
+            std::printf("speed %g over bounds %gx smaller: not level %zu\n", c.speed, c.shrink, c.level);
+            failed++;
+        }
+    }
+
+    // a fresh terrain maps the files the first one wrote
+    std::map<fs::path, fs::file_time_type> written;
+    for (auto& entry:fs::directory_iterator(dir))
+        if (entry.path() != file) written[entry.path()] = entry.last_write_time();
+    ImageTerrain cached(dir);
+    cached.open(file, nullptr, progress);
+    size_t rewritten = 0, differ = 0;
+    for (auto& entry:fs::directory_iterator(dir)){
+        if (entry.path() == file) continue;
+        auto w = written.find(entry.path());
+        if (w == written.end() || w->second != entry.last_write_time()) rewritten++;
+    }
+    if (cached.numLevels() != levels.size()) differ++;
+    for (size_t l = 0; differ == 0 && l < levels.size(); l++){
+        const Grid& g = levels[l];
+        float speed = 1.5f * float(1 << l);
+        for (int32_t y = 0; y < g.height; y++)
+            for (int32_t x = 0; x < g.width; x++)
+                if (read(cached, g, top, x, y, speed) != read(built, g, top, x, y, speed)) differ++;
+    }
+    std::printf("cached: %zu of %zu files rewritten, %zu samples differ\n", rewritten, written.size(), differ);
+    failed += rewritten + differ;
+    fs::remove_all(dir);
+    return failed == 0 && written.size() == levels.size() ? 0 : 1;
+}
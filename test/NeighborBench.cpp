@@ -0,0 +1,45 @@
+// Time per tick of avoid, join and align on one flock, with the spatial
+// grid and with the brute force scan Runtime::useSpatialGrid switches to.
+// Sizes are agent counts, 500 2000 8000 unless given as arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Flock.hpp"
+
+// milliseconds per tick, agents move every tick so the grid is rebuilt
+static double run(int agents, bool useGrid, int ticks, ThreadPool& pool){
+    const vec2 bounds(1280, 720);
+    Flock f(agents, "triangle", "white", nullptr, nullptr, Rng(1, 0), bounds);
+    f.setPool(&pool);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++){
+        f.index(50, useGrid);
+        f.avoid(25, 1, nullptr);
+        f.join(50, 1, nullptr);
+        f.align(50, 1, nullptr);
+        f.go(1);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / ticks;
+}
+
+int main(int argc, char* argv[]){
+    std::vector<int> sizes{500, 2000, 8000};
+    if (argc > 1){
+        sizes.clear();
+        for (int i = 1; i < argc; i++) sizes.push_back(std::atoi(argv[i]));
+    }
+    ThreadPool pool;
+    std::printf("%10s %12s %12s\n", "agents", "grid ms", "scan ms");
+    for (int n:sizes){
+        // fewer ticks for the quadratic scan on large flocks
+        int ticks = std::max(2, 200000 / n);
+        double grid = run(n, true, ticks, pool);
+        double scan = run(n, false, std::max(2, ticks * 500 / n), pool);
+        std::printf("%10d %12.3f %12.3f\n", n, grid, scan);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Every neighbour kernel compiled in, and supported by this CPU, must
+// give the scalar kernel's result exactly: same neighbours in the same
+// order, same displacement and distance. Candidate lists have lengths
+// that leave SIMD tails, and points sit near the edges so displacements
+// wrap. Thresholds stay under half the world, where rounding half a
+// world either way would be a real difference.
+
+#include <cstdio>
+#include <vector>
+#include "NeighborKernel.hpp"
+#include "Random.hpp"
+
+using namespace kernel;
+
+struct Variant{
+    const char* name;
+    NeighborKernel fn;
+};
+
+static std::vector<Variant> variants(){
+    std::vector<Variant> out;
+#ifdef BRUNZIT_SIMD_X86
+    out.push_back({"sse", neighborsSSE});
+#endif
+#ifdef BRUNZIT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) out.push_back({"avx2", neighborsAVX2});
+#endif
+    return out;
+}
+
+static bool same(const Neighbor& a, const Neighbor& b){
+    return a.index == b.index && a.diff.x == b.diff.x && a.diff.y == b.diff.y && a.dist == b.dist;
+}
+
+int main(){
+    Rng rng(3, 0);
+    const float w = 800, h = 450;
+    std::vector<float> xy;
+    for (int i = 0; i < 4000; i++){
+        float x = rng.uniform(0, w), y = rng.uniform(0, h);
+        if (i % 3 == 0) x = rng.uniform() < 0.5f ? rng.uniform(0, 30) : w - rng.uniform(0, 30);
+        if (i % 5 == 0) y = rng.uniform() < 0.5f ? rng.uniform(0, 30) : h - rng.uniform(0, 30);
+        xy.push_back(x);
+        xy.push_back(y);
+    }
+    // duplicates give distance 0, which every kernel must skip
+    xy[2] = xy[0];
+    xy[3] = xy[1];
+    std::vector<int> idx(xy.size() / 2);
+    std::vector<Neighbor> expected(idx.size()), got(idx.size());
+    size_t checked = 0, failed = 0, found = 0;
+    for (Variant v:variants()){
+        for (int q = 0; q < 300; q++){
+            // candidates in shuffled order, of any length
+            size_t n = 1 + rng.next() % idx.size();
+            for (size_t k = 0; k < n; k++) idx[k] = int(rng.next() % idx.size());
+            int self = int(rng.next() % idx.size());
+            float threshold = rng.uniform(1, h / 2 - 1);
+            float px = xy[2 * self], py = xy[2 * self + 1];
+            size_t a = neighborsScalar(xy.data(), idx.data(), n, px, py, threshold, w, h, expected.data());
+            size_t b = v.fn(xy.data(), idx.data(), n, px, py, threshold, w, h, got.data());
+            bool ok = a == b;
+            for (size_t k = 0; ok && k < a; k++) ok = same(expected[k], got[k]);
+            if (!ok){
+                std::printf("%s differs: query %d, %zu candidates, threshold %g\n", v.name, q, n, threshold);
+                failed++;
+            }
+            checked++;
+            found += a;
+        }
+    }
+    std::printf("%zu queries against scalar, %zu neighbours, %zu failed\n", checked, found, failed);
+    return failed == 0 ? 0 : 1;
+}
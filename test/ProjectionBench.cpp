@@ -0,0 +1,71 @@
+// Time and peak memory of the corpus projection: UMAP layout then grid
+// cells, for synthetic descriptor rows scattered around a few centres.
+// Sizes are segment counts, 1000 10000 20000 100000 unless given as
+// arguments; 20000 is the largest corpus embedded whole.
+// Peak RSS only grows, so sizes run in the order given and each one
+// reports the peak so far; run one size per process for exact figures.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <sys/resource.h>
+#include "Projection.hpp"
+
+// descriptor rows: numCentres gaussian clusters in dims dimensions
+static RealMatrix makeRows(index rows, index dims, uint32_t seed){
+    const index numCentres = 16;
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::normal_distribution<double> noise(0, 0.1);
+    RealMatrix centres(numCentres, dims);
+    for (index c = 0; c < numCentres; c++)
+        for (index d = 0; d < dims; d++) centres(c, d) = uniform(gen);
+    RealMatrix out(rows, dims);
+    for (index i = 0; i < rows; i++){
+        index c = index(gen() % numCentres);
+        for (index d = 0; d < dims; d++) out(i, d) = centres(c, d) + noise(gen);
+    }
+    return out;
+}
+
+// kilobytes on Linux, bytes on macOS
+static double peakMegabytes(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+int main(int argc, char* argv[]){
+    std::vector<index> sizes{1000, 10000, 20000, 100000};
+    if (argc > 1){
+        sizes.clear();
+        for (int i = 1; i < argc; i++) sizes.push_back(std::atol(argv[i]));
+    }
+    const index dims = 20;
+    ThreadPool pool;
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point a, Clock::time_point b){
+        return std::chrono::duration<double>(b - a).count();
+    };
+    std::printf("%10s %10s %10s %12s\n", "segments", "embed s", "grid s", "peak MB");
+    for (index n:sizes){
+        RealMatrix rows = makeRows(n, dims, uint32_t(n));
+        Projection projection;
+        projection.setPool(&pool);
+        auto start = Clock::now();
+        RealMatrix layout = projection.embed(rows);
+        auto embedded = Clock::now();
+        RealMatrix cells = projection.gridPositions(layout);
+        auto gridded = Clock::now();
+        if (cells.rows() != n) return 1;
+        std::printf("%10ld %10.2f %10.2f %12.1f\n", long(n), seconds(start, embedded),
+                    seconds(embedded, gridded), peakMegabytes());
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Every sine bank compiled in, and supported by this CPU, must follow a
+// double precision bank of true sines to within the parabolic sine's
+// error, 0.0011 per unit of volume. Voices glide to new frequencies over
+// several blocks, so phase, glide and wrap carry from block to block.
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "Oscillator.hpp"
+#include "Random.hpp"
+
+using namespace osc;
+
+static const double BOUND = 0.0011;
+
+struct Variant{
+    const char* name;
+    SineBank fn;
+};
+
+static std::vector<Variant> variants(){
+    std::vector<Variant> out{{"scalar", sineBankScalar}};
+#ifdef BRUNZIT_SIMD_X86
+    out.push_back({"sse", sineBankSSE});
+#endif
+#ifdef BRUNZIT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) out.push_back({"avx2", sineBankAVX2});
+#endif
+    return out;
+}
+
+int main(){
+    const double twoPi = 2 * M_PI;
+    double worst = 0;
+    for (int i = 0; i < 1000000; i++){
+        float p = i / 1000000.0f;
+        worst = std::max(worst, std::fabs(sine(p) - std::sin(twoPi * p)));
+    }
+    std::printf("sine: worst error %.5f\n", worst);
+    bool ok = worst <= BOUND;
+
+    const size_t numVoices = 24, numFrames = 64, numBlocks = 8;
+    for (Variant v:variants()){
+        Rng rng(5, 0);
+        std::vector<float> phase(numVoices), incr(numVoices), target(numVoices), volume(numVoices);
+        std::vector<double> refPhase(numVoices), refIncr(numVoices);
+        for (size_t k = 0; k < numVoices; k++){
+            phase[k] = rng.uniform();
+            incr[k] = rng.uniform(0.001f, 0.05f);
+            volume[k] = rng.uniform();
+            refPhase[k] = phase[k];
+            refIncr[k] = incr[k];
+        }
+        std::vector<float> acc(numFrames * MAX_LANES), out(numFrames);
+        double volumes = 0;
+        for (float vol:volume) volumes += vol;
+        double error = 0;
+        for (size_t b = 0; b < numBlocks; b++){
+            for (auto& t:target) t = rng.uniform(0.001f, 0.05f);
+            std::fill(out.begin(), out.end(), 0.0f);
+            v.fn(phase.data(), incr.data(), target.data(), volume.data(), numVoices,
+                 acc.data(), out.data(), numFrames);
+            for (size_t i = 0; i < numFrames; i++){
+                double ref = 0;
+                for (size_t k = 0; k < numVoices; k++){
+                    double inc = refIncr[k] + (target[k] - refIncr[k]) * (i + 1) / numFrames;
+                    double& p = refPhase[k];
+                    p += inc;
+                    if (p >= 1) p -= 1;
+                    ref += volume[k] * std::sin(twoPi * p);
+                }
+                error = std::max(error, std::fabs(out[i] - ref));
+            }
+            for (size_t k = 0; k < numVoices; k++) refIncr[k] = target[k];
+        }
+        // per unit of volume, with room for float phase against double
+        double perVolume = error / volumes;
+        std::printf("%s: worst error %.5f per unit of volume\n", v.name, perVolume);
+        if (perVolume > BOUND + 1e-4) ok = false;
+    }
+    return ok ? 0 : 1;
+}
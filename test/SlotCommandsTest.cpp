@@ -0,0 +1,74 @@
+// Stress test for SlotCommands: every tick sends a new value to each slot
+// from whichever pool worker runs it, while a consumer thread drains
+// concurrently. A slot must never go back to an older value, and must
+// end on the last value sent.
+// Threads that push to two instances in turn, as the simulation does to
+// the additive and granular mixers, must keep one ring per instance
+// instead of running out of rings.
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "SlotCommands.hpp"
+#include "ThreadPool.hpp"
+
+static bool stress(){
+    const size_t numSlots = 512;
+    const uint32_t numTicks = 2000;
+    SlotCommands<uint32_t> commands(numSlots, 4096);
+    ThreadPool pool(8);
+    std::vector<uint32_t> values(numSlots, 0);
+    std::atomic<bool> running{true};
+    std::atomic<size_t> regressions{0};
+    auto apply = [&](size_t slot, uint32_t value){
+        if (value < values[slot]) regressions++;
+        values[slot] = value;
+    };
+    std::thread consumer([&]{
+        while (running) commands.drain(apply);
+    });
+    for (uint32_t tick = 1; tick <= numTicks; tick++){
+        pool.parallelFor(0, numSlots, 4, [&](size_t begin, size_t end, size_t){
+            for (size_t slot = begin; slot < end; slot++)
+                while (!commands.push(slot, tick)) std::this_thread::yield();
+        });
+    }
+    running = false;
+    consumer.join();
+    commands.drain(apply);
+    size_t stale = 0;
+    for (uint32_t v:values) if (v != numTicks) stale++;
+    std::printf("regressions %zu, stale slots %zu\n", regressions.load(), stale);
+    return regressions == 0 && stale == 0;
+}
+
+static bool alternate(){
+    const size_t numSlots = 64;
+    const uint32_t rounds = 4 * SlotCommands<uint32_t>::MAX_PRODUCERS;
+    SlotCommands<uint32_t> a(numSlots, 64), b(numSlots, 64);
+    ThreadPool pool(8);
+    std::atomic<size_t> failed{0};
+    std::vector<uint32_t> va(numSlots, 0), vb(numSlots, 0);
+    for (uint32_t round = 1; round <= rounds; round++){
+        pool.parallelFor(0, numSlots, 1, [&](size_t begin, size_t end, size_t){
+            for (size_t slot = begin; slot < end; slot++){
+                if (!a.push(slot, round)) failed++;
+                if (!b.push(slot, round)) failed++;
+            }
+        });
+        a.drain([&](size_t slot, uint32_t v){va[slot] = v;});
+        b.drain([&](size_t slot, uint32_t v){vb[slot] = v;});
+    }
+    size_t stale = 0;
+    for (size_t slot = 0; slot < numSlots; slot++)
+        if (va[slot] != rounds || vb[slot] != rounds) stale++;
+    std::printf("alternating: failed pushes %zu, stale slots %zu\n", failed.load(), stale);
+    return failed == 0 && stale == 0;
+}
+
+int main(){
+    bool ok = stress();
+    ok = alternate() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// The grid must find the same neighbours as the brute force scan it
+// replaces. Agents are crowded along the edges and corners of the world,
+// so many neighbour pairs are only close across the toroidal wrap.
+// Thresholds go from under a cell to more than half the world, where
+// the query covers every cell.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "SpatialGrid.hpp"
+#include "NeighborKernel.hpp"
+#include "Random.hpp"
+
+// most agents within margin of an edge, some exactly on it
+static std::vector<vec2> edgeAgents(size_t n, vec2 bounds, float margin, Rng& rng){
+    std::vector<vec2> out;
+    for (size_t i = 0; i < n; i++){
+        float x = rng.uniform(0, bounds.x), y = rng.uniform(0, bounds.y);
+        float r = rng.uniform();
+        if (r < 0.4f) x = rng.uniform() < 0.5f ? rng.uniform(0, margin) : bounds.x - rng.uniform(0, margin);
+        else if (r < 0.8f) y = rng.uniform() < 0.5f ? rng.uniform(0, margin) : bounds.y - rng.uniform(0, margin);
+        else if (r < 0.9f){
+            x = rng.uniform() < 0.5f ? rng.uniform(0, margin) : bounds.x - rng.uniform(0, margin);
+            y = rng.uniform() < 0.5f ? rng.uniform(0, margin) : bounds.y - rng.uniform(0, margin);
+        }
+        else if (r < 0.95f) x = rng.uniform() < 0.5f ? 0 : bounds.x;
+        out.push_back(vec2(x, y));
+    }
+    return out;
+}
+
+int main(){
+    Rng rng(1, 0);
+    kernel::NeighborKernel neighbors = kernel::selectNeighborKernel();
+    const std::vector<vec2> sizes{vec2(1280, 720), vec2(1001, 613)};
+    const std::vector<float> thresholds{7.5f, 25, 50, 133, 400};
+    size_t mismatches = 0, pairs = 0, wrapped = 0;
+    for (vec2 bounds:sizes){
+        std::vector<vec2> positions = edgeAgents(3000, bounds, 40, rng);
+        const float* xy = reinterpret_cast<const float*>(positions.data());
+        std::vector<int> all(positions.size());
+        for (size_t i = 0; i < all.size(); i++) all[i] = int(i);
+        std::vector<kernel::Neighbor> scratch(positions.size());
+        std::vector<int> fromGrid, fromScan;
+        for (float threshold:thresholds){
+            SpatialGrid grid;
+            grid.build(positions, threshold, bounds);
+            for (size_t i = 0; i < positions.size(); i++){
+                vec2 pos = positions[i];
+                auto collect = [&](std::vector<int>& out){
+                    return [&](const int* items, size_t n){
+                        size_t found = neighbors(xy, items, n, pos.x, pos.y, threshold,
+                                                 bounds.x, bounds.y, scratch.data());
+                        for (size_t k = 0; k < found; k++) out.push_back(scratch[k].index);
+                    };
+                };
+                fromGrid.clear();
+                fromScan.clear();
+                grid.querySpans(pos, threshold, collect(fromGrid));
+                collect(fromScan)(all.data(), all.size());
+                std::sort(fromGrid.begin(), fromGrid.end());
+                if (fromGrid != fromScan) mismatches++;
+                pairs += fromScan.size();
+                for (int j:fromScan){
+                    vec2 d = positions[j] - pos;
+                    if (std::fabs(d.x) > bounds.x / 2 || std::fabs(d.y) > bounds.y / 2) wrapped++;
+                }
+            }
+        }
+    }
+    std::printf("mismatches %zu, pairs %zu, across the wrap %zu\n", mismatches, pairs, wrapped);
+    return mismatches == 0 && wrapped > 0 ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+// Nested parallelFor loops must cover every item once. A thread waiting
+// for chunks that run elsewhere must sleep, not spin: its CPU time over
+// a loop whose other chunk sleeps has to stay far below the wall time.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include "ThreadPool.hpp"
+
+static double threadCpuMs(){
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+int main(){
+    ThreadPool pool(4);
+    const size_t outer = 64, inner = 1000;
+    std::vector<std::atomic<int>> hits(outer * inner);
+    for (auto& h:hits) h = 0;
+    pool.parallelFor(0, outer, 3, [&](size_t begin, size_t end, size_t){
+        for (size_t o = begin; o < end; o++){
+            pool.parallelFor(0, inner, 100, [&](size_t b, size_t e, size_t){
+                for (size_t i = b; i < e; i++) hits[o * inner + i]++;
+            });
+        }
+    });
+    size_t wrong = 0;
+    for (auto& h:hits) if (h != 1) wrong++;
+
+    // the caller's chunk is short, a worker takes the long one
+    using namespace std::chrono;
+    double cpu = threadCpuMs();
+    auto start = steady_clock::now();
+    pool.parallelFor(0, 2, 1, [&](size_t begin, size_t, size_t){
+        std::this_thread::sleep_for(milliseconds(begin == 0 ? 20 : 300));
+    });
+    double wall = duration<double, std::milli>(steady_clock::now() - start).count();
+    cpu = threadCpuMs() - cpu;
+    std::printf("%zu items hit other than once, waited %.0f ms using %.1f ms cpu\n", wrong, wall, cpu);
+    return wrong == 0 && cpu < wall / 4 ? 0 : 1;
+}